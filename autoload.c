@@ -0,0 +1,65 @@
+/* Library definitions that are loaded on first reference.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#include "autoload.h"
+#include "environment.h"
+#include "error.h"
+#include "eval.h"
+#include "object.h"
+#include "port.h"
+#include "read.h"
+#include "table.h"
+
+/* The definitions in stdlib.scm are compiled into bs. stdlib.inc is
+ * generated from stdlib.scm by the build, and has one entry for each
+ * top-level definition in it, holding the defined name and the definition's
+ * source text.
+ */
+static struct {
+    char const *name;
+    char const *source;
+} const stdlib[] = {
+#include "stdlib.inc"
+};
+
+
+/* Binds every library name in env to a stub that loads its definition the
+ * first time the name is looked up.
+ */
+void init_autoload(object *env)
+{
+    for (size_t i = 0; i < sizeof(stdlib) / sizeof(stdlib[0]); i++) {
+        define_variable(make_symbol(stdlib[i].name),
+                make_autoload(stdlib[i].source), env);
+    }
+}
+
+
+/* Replaces the autoload stub in binding with the value of its definition.
+ * Definitions are evaluated in the global environment, where the stubs are.
+ */
+void run_autoload(object *binding)
+{
+    object *port = make_input_string_port(cdr(binding)->value.autoload);
+    object *definition = bs_read(port);
+    close_port(port);
+
+    bs_eval(definition, get_global_environment());
+    if (is_autoload(cdr(binding))) {
+        error("autoloading '%s' did not define it",
+                car(binding)->value.symbol);
+    }
+}
+
+
+/* Loads every library definition in env now, rather than on first use.
+ */
+void preload_autoloads(object *env)
+{
+    for (size_t i = 0; i < sizeof(stdlib) / sizeof(stdlib[0]); i++) {
+        lookup_variable_value(make_symbol(stdlib[i].name), env);
+    }
+}
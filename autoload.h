@@ -0,0 +1,17 @@
+/* Library definitions that are loaded on first reference.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef AUTOLOAD_H
+#define AUTOLOAD_H
+
+#include "object.h"
+
+void init_autoload(object *env);
+void run_autoload(object *binding);
+void preload_autoloads(object *env);
+
+#endif
+
@@ -0,0 +1,208 @@
+/* Running many programs in parallel.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "gc.h"
+
+#include "batch.h"
+#include "environment.h"
+#include "error.h"
+#include "eval.h"
+#include "object.h"
+#include "port.h"
+#include "read.h"
+#include "write.h"
+
+/* Each program runs in a child forked from the warm parent, so it starts
+ * with everything the parent has loaded, and can't affect the programs that
+ * run after it. A child's standard output goes into a pipe. The parent
+ * passes along the output of the earliest program that hasn't finished yet
+ * as it arrives, and holds on to the output of later ones until their turn.
+ * Standard error is shared, and isn't kept in order.
+ */
+struct job {
+    char const *file;
+    pid_t pid;
+    int fd;             // read end of the child's output pipe, or -1
+    char *output;       // output held back until it's this job's turn
+    size_t len, size;
+    int status;
+};
+
+
+static void run_file(char const *file, int print_results)
+{
+    object *port = make_input_port(file);
+    set_input_port(port);
+
+    object *obj = bs_read(port);
+    while (!is_end_of_file(obj)) {
+        object *result = bs_eval(obj, get_global_environment());
+        if (print_results) {
+            bs_write(result);
+            write_output_char('\n');
+        }
+        obj = bs_read(port);
+    }
+}
+
+
+static void start_job(struct job *job, int print_results)
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        error("unable to create pipe:");
+    }
+
+    // Buffered output would otherwise be written by both processes.
+    flush_output_ports();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (dup2(fds[1], STDOUT_FILENO) < 0) {
+            error("unable to redirect output:");
+        }
+        close(fds[1]);
+        forget_output_ports();
+        run_file(job->file, print_results);
+        exit(0);
+    } else if (pid < 0) {
+        error("unable to fork:");
+    }
+
+    close(fds[1]);
+    job->pid = pid;
+    job->fd = fds[0];
+}
+
+
+static void hold_output(struct job *job, char const *data, size_t len)
+{
+    if (job->len + len > job->size) {
+        job->size = job->size == 0 ? PORT_BUFFER_SIZE : job->size * 2;
+        while (job->size < job->len + len) {
+            job->size *= 2;
+        }
+        job->output = GC_REALLOC(job->output, job->size);
+        if (job->output == NULL) {
+            error("unable to allocate output buffer:");
+        }
+    }
+    memcpy(job->output + job->len, data, len);
+    job->len += len;
+}
+
+
+/* Reads what job's child has written. Returns 0 once it has finished.
+ */
+static int read_job(struct job *job, int current)
+{
+    char buf[PORT_BUFFER_SIZE];
+    ssize_t bytes;
+    do {
+        bytes = read(job->fd, buf, sizeof(buf));
+    } while (bytes < 0 && errno == EINTR);
+
+    if (bytes > 0) {
+        if (current) {
+            write_port_bytes(get_standard_output_port(), buf, (size_t)bytes);
+        } else {
+            hold_output(job, buf, (size_t)bytes);
+        }
+        return 1;
+    }
+
+    close(job->fd);
+    job->fd = -1;
+    int status;
+    while (waitpid(job->pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            error("unable to wait for child process:");
+        }
+    }
+    job->status = WIFEXITED(status) ? WEXITSTATUS(status) :
+        128 + WTERMSIG(status);
+    return 0;
+}
+
+
+/* Runs the programs in files, up to jobs at a time, and writes their output
+ * in the order the files were given. Returns the highest exit status of any
+ * of them.
+ */
+int run_batch(char **files, int count, int jobs, int print_results)
+{
+    struct job *job = GC_MALLOC((size_t)count * sizeof(struct job));
+    struct pollfd *pfds = GC_MALLOC((size_t)jobs * sizeof(struct pollfd));
+    int *polled = GC_MALLOC((size_t)jobs * sizeof(int));
+    if (job == NULL || pfds == NULL || polled == NULL) {
+        error("unable to allocate job table:");
+    }
+    for (int i = 0; i < count; i++) {
+        job[i].file = files[i];
+        job[i].fd = -1;
+    }
+
+    int started = 0, running = 0, current = 0, result = 0;
+    while (current < count) {
+        while (running < jobs && started < count) {
+            start_job(&job[started++], print_results);
+            running++;
+        }
+
+        int n = 0;
+        for (int i = current; i < started; i++) {
+            if (job[i].fd >= 0) {
+                pfds[n].fd = job[i].fd;
+                pfds[n].events = POLLIN;
+                polled[n++] = i;
+            }
+        }
+        if (n > 0 && poll(pfds, (nfds_t)n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error("unable to wait for output:");
+        }
+        for (int i = 0; i < n; i++) {
+            if (pfds[i].revents != 0 &&
+                    !read_job(&job[polled[i]], polled[i] == current)) {
+                running--;
+            }
+        }
+
+        // Pass along the output of every job that's had its turn, and what
+        // the next one has written so far.
+        while (current < count && current < started) {
+            struct job *j = &job[current];
+            if (j->len > 0) {
+                write_port_bytes(get_standard_output_port(), j->output,
+                        j->len);
+                j->output = NULL;
+                j->len = j->size = 0;
+            }
+            if (j->fd >= 0) {
+                break;
+            }
+            if (j->status > result) {
+                result = j->status;
+            }
+            current++;
+        }
+        flush_port(get_standard_output_port());
+    }
+    return result;
+}
+
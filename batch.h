@@ -0,0 +1,13 @@
+/* Running many programs in parallel.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+int run_batch(char **files, int count, int jobs, int print_results);
+
+#endif
+
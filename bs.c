@@ -5,27 +5,42 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "gc.h"
 
+#include "autoload.h"
+#include "batch.h"
 #include "environment.h"
 #include "error.h"
 #include "eval.h"
+#include "fasl.h"
+#include "lexer.h"
 #include "object.h"
 #include "port.h"
 #include "primitive.h"
 #include "read.h"
+#include "server.h"
 #include "write.h"
 
 
 struct config {
     int print_results;
     object *input_port;
+    char const *image;          // image to start from, if any
+    char const *dump_image;     // where to save an image at the end, if any
+    char const *socket;         // where to serve requests, if anywhere
+    int each_line;              // call the program's value on each input line
+    char const *separator;      // field separator for each_line, if any
+    int jobs;                   // run each file on its own, this many at once
+    char **files;               // input files for each_line, or programs
+    int file_count;
 };
 
 void init_system(void);
 void print_usage(void);
 struct config *parse_options(int argc, char *argv[]);
+void run_each_line(object *proc, struct config *conf);
 
 
 int main(int argc, char *argv[])
@@ -33,16 +48,41 @@ int main(int argc, char *argv[])
     init_system();
 
     struct config *conf = parse_options(argc, argv);
+    if (conf->input_port == NULL) {
+        // Only a server can start without a program.
+        conf->input_port = make_input_string_port("");
+    }
     set_input_port(conf->input_port);
+    if (conf->image != NULL) {
+        load_image(conf->image);
+    }
+    if (conf->jobs > 0) {
+        preload_autoloads(get_global_environment());
+        return run_batch(conf->files, conf->file_count, conf->jobs,
+                conf->print_results);
+    }
 
-    object *obj = bs_read();
+    object *result = get_empty_list();
+    object *obj = bs_read(conf->input_port);
     while (!is_end_of_file(obj)) {
-        object *result = bs_eval(obj, get_global_environment());
+        result = bs_eval(obj, get_global_environment());
         if (conf->print_results) {
             bs_write(result);
-            write_output("\n");
+            write_output_char('\n');
         }
-        obj = bs_read();
+        obj = bs_read(conf->input_port);
+    }
+
+    if (conf->each_line) {
+        run_each_line(result, conf);
+    }
+
+    if (conf->dump_image != NULL) {
+        dump_image(conf->dump_image);
+    }
+    if (conf->socket != NULL) {
+        preload_autoloads(get_global_environment());
+        serve(conf->socket);
     }
     return 0;
 }
@@ -52,24 +92,136 @@ void init_system(void)
 {
     GC_INIT();
     init_standard_ports();
+    init_lexer();
     set_error_level(WARNING);
     init_special_forms();
     init_global_environment();
     init_primitives(get_global_environment());
+    init_autoload(get_global_environment());
+}
+
+
+/* Splits line at each occurrence of sep, and returns the fields in a vector.
+ * A sep of " " splits at runs of blanks instead, and ignores leading and
+ * trailing ones, like awk does. The fields share a single copy of line,
+ * with the separators overwritten by terminators.
+ */
+static object *split_fields(char const *line, size_t len, char const *sep)
+{
+    char *buf = GC_MALLOC_ATOMIC(len + 1);
+    if (buf == NULL) {
+        error("unable to allocate field buffer:");
+    }
+    memcpy(buf, line, len + 1);
+
+    int blanks = strcmp(sep, " ") == 0;
+    size_t sep_len = strlen(sep);
+
+    // Count the fields first, so the vector can be filled in one pass.
+    long count = 0;
+    if (blanks) {
+        for (char const *s = buf; *s != '\0'; ) {
+            s += strspn(s, " \t");
+            if (*s != '\0') {
+                count++;
+                s += strcspn(s, " \t");
+            }
+        }
+    } else {
+        count = 1;
+        for (char const *s = strstr(buf, sep); s != NULL;
+                s = strstr(s + sep_len, sep)) {
+            count++;
+        }
+    }
+
+    object *fields = make_vector(count, get_empty_list());
+    char *s = buf;
+    for (long i = 0; i < count; i++) {
+        char *end;
+        if (blanks) {
+            s += strspn(s, " \t");
+            end = s + strcspn(s, " \t");
+        } else {
+            end = strstr(s, sep);
+            if (end == NULL) {
+                end = s + strlen(s);
+            }
+        }
+        char *next = (*end == '\0') ? end : end + (blanks ? 1 : sep_len);
+        *end = '\0';
+        fields->value.vector.items[i] = make_string(s);
+        s = next;
+    }
+    return fields;
+}
+
+
+/* Calls proc with each line of port, without its newline. If a field
+ * separator was given, the line's fields are passed as a vector too.
+ */
+static void each_line(object *proc, object *port, char const *separator)
+{
+    char *line;
+    while (read_line(port, &line) >= 0) {
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+
+        object *arguments = get_empty_list();
+        if (separator != NULL) {
+            arguments = cons(split_fields(line, len, separator), arguments);
+        }
+        bs_apply(proc, cons(make_string(line), arguments));
+    }
+}
+
+
+void run_each_line(object *proc, struct config *conf)
+{
+    if (!is_procedure(proc)) {
+        error("-n needs a program whose value is a procedure");
+    }
+
+    if (conf->file_count == 0) {
+        each_line(proc, get_standard_input_port(), conf->separator);
+    }
+    for (int i = 0; i < conf->file_count; i++) {
+        if (strcmp(conf->files[i], "-") == 0) {
+            each_line(proc, get_standard_input_port(), conf->separator);
+        } else {
+            object *port = make_input_port(conf->files[i]);
+            each_line(proc, port, conf->separator);
+            close_port(port);
+        }
+    }
 }
 
 
 void print_usage(void)
 {
-    write_error("usage: bs file [-p]\n");
+    write_error("usage: bs [--image img] [--dump-image img] file [-p]\n");
+    write_error("       bs [options] -e expr [-n [-F sep]] [input...]\n");
+    write_error("       bs [options] -j jobs file...\n");
     write_error("file : a scheme source file, or '-' to read from stdin.\n");
     write_error("-p   : print the result of each expression in file.\n");
+    write_error("-e expr : run the expressions in expr instead of a file.\n");
+    write_error("-n      : call the program's value with each input line.\n");
+    write_error("-F sep  : also pass the line's fields, split at sep.\n");
+    write_error("-j jobs : run each file on its own, jobs at a time.\n");
+    write_error("--image img      : start from the image img.\n");
+    write_error("--dump-image img : "
+            "save an image to img after running file.\n");
+    write_error("--read-ahead     : read stdin and input pipes in a thread.\n");
+    write_error("--serve sock     : "
+            "serve requests on sock after running file.\n");
 }
 
 
 struct config *parse_options(int argc, char *argv[])
 {
-    if (argc < 2 || argc > 3) {
+    if (argc < 2) {
         print_usage();
         exit(1);
     }
@@ -82,9 +234,42 @@ struct config *parse_options(int argc, char *argv[])
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-p") == 0) {
             conf->print_results = 1;
+        } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            conf->image = argv[++i];
+        } else if (strcmp(argv[i], "--dump-image") == 0 && i + 1 < argc) {
+            conf->dump_image = argv[++i];
+        } else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc &&
+                conf->input_port == NULL) {
+            conf->input_port = make_input_string_port(argv[++i]);
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            conf->socket = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc &&
+                conf->input_port == NULL) {
+            conf->jobs = atoi(argv[++i]);
+            if (conf->jobs < 1) {
+                print_usage();
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--read-ahead") == 0) {
+            enable_read_ahead();
+        } else if (strcmp(argv[i], "-n") == 0) {
+            conf->each_line = 1;
+        } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc &&
+                argv[i + 1][0] != '\0') {
+            conf->separator = argv[++i];
         } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
             print_usage();
             exit(1);
+        } else if (conf->jobs > 0) {
+            // Everything after -j is a program to run.
+            conf->files = argv + i;
+            conf->file_count = argc - i;
+            break;
+        } else if (conf->input_port != NULL && conf->each_line) {
+            // Everything after the program is input for each_line.
+            conf->files = argv + i;
+            conf->file_count = argc - i;
+            break;
         } else if (conf->input_port == NULL) {
             if (strcmp(argv[i], "-") == 0) {
                 conf->input_port = get_standard_input_port();
@@ -98,7 +283,19 @@ struct config *parse_options(int argc, char *argv[])
     }
 
 
-    if (conf->input_port == NULL) {
+    if (conf->jobs > 0) {
+        if (conf->file_count == 0 || conf->input_port != NULL ||
+                conf->each_line || conf->socket != NULL ||
+                conf->dump_image != NULL) {
+            print_usage();
+            exit(1);
+        }
+        return conf;
+    }
+
+    if ((conf->input_port == NULL && conf->socket == NULL) ||
+            (conf->separator != NULL && !conf->each_line) ||
+            (conf->socket != NULL && conf->each_line)) {
         print_usage();
         exit(1);
     }
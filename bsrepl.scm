@@ -1,17 +1,37 @@
 ;; bs REPL
 (load "stdlib.scm")
 
+(define (bs-report-error e)
+  (display "error: ")
+  (cond ((error-object? e)
+         (display (error-object-message e))
+         (for-each (lambda (x) (display " ") (write x))
+                   (error-object-irritants e)))
+        (else
+          (display "uncaught exception: ")
+          (write e)))
+  (newline))
+
+;; Returned when input can't be read. It's a new pair, so no input can be it.
+(define bs-repl-failed (list 'failed))
+
 (define (bs-repl)
   (display "bs> ")
-  (let ((expr (read (stdin-port))))
+  (let ((expr (with-exception-handler
+                (lambda (e) (bs-report-error e) bs-repl-failed)
+                (lambda () (read (stdin-port))))))
     (cond ((eof-object? expr)
            (display "goodbye!\n")
            'ok)
+          ((eq? expr bs-repl-failed)
+           (bs-repl))
           (else
-            (write (eval expr (interaction-environment)))
-            (newline)
+            (with-exception-handler
+              (lambda (e) (bs-report-error e))
+              (lambda ()
+                (write (eval expr (interaction-environment)))
+                (newline)))
             (bs-repl)))))
 
 (display "Welcome to the bs REPL. Press ctrl-d to exit.\n")
 (bs-repl)
-
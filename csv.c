@@ -0,0 +1,204 @@
+/* Reading and writing comma separated values.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "gc.h"
+
+#include "csv.h"
+#include "error.h"
+#include "object.h"
+#include "port.h"
+
+/* Rows are read as described in RFC 4180. Fields are separated by commas and
+ * rows by newlines, optionally preceded by a carriage return. A field in
+ * double quotes may contain commas, newlines, and double quotes written
+ * twice.
+ *
+ * A row is first scanned in place in the port buffer, the way the lexer
+ * scans a token, to find where it ends and how many fields it has. Then each
+ * field is copied out of the buffer into a string of its own, and the
+ * strings go straight into a vector of the right length.
+ */
+
+
+/* Scans the row at the read position of port. Returns its length, not
+ * counting the newline, and sets *fields to the number of fields in it and
+ * *consumed to the number of bytes to skip past it.
+ */
+static size_t scan_row(object *port, long *fields, size_t *consumed)
+{
+    struct port_buffer *b = port->value.port.buffer;
+    size_t len = 0;
+    long count = 1;
+    int quoted = 0;
+
+    // A doubled quote inside a quoted field just leaves and re-enters the
+    // quotes, so toggling is enough to tell which commas separate fields.
+    while (port_lookahead(port, len) != EOF) {
+        char const *start = port_position(port);
+        char const *end = b->data + b->end;
+        char const *s = start + len;
+        while (s < end) {
+            char c = *s;
+            if (c == '"') {
+                quoted = !quoted;
+            } else if (!quoted && c == ',') {
+                count++;
+            } else if (!quoted && c == '\n') {
+                *fields = count;
+                *consumed = (size_t)(s - start) + 1;
+                return (size_t)(s - start);
+            }
+            s++;
+        }
+        len = (size_t)(s - start);
+    }
+
+    if (quoted) {
+        // Consume the rest of the input, so that it isn't scanned again.
+        port_advance(port, len);
+        error("end of file inside a quoted field");
+    }
+    *fields = count;
+    *consumed = len;
+    return len;
+}
+
+
+/* Copies the field that starts at s out of a row that ends at end, removing
+ * its quotes. Sets *next to the start of the following field.
+ */
+static object *read_field(char const *s, char const *end, char const **next)
+{
+    char const *stop = s;
+    int quoted = 0, quotes = 0;
+    while (stop < end && (quoted || *stop != ',')) {
+        if (*stop == '"') {
+            quoted = !quoted;
+            quotes = 1;
+        }
+        stop++;
+    }
+    *next = stop + 1;
+
+    size_t len = (size_t)(stop - s);
+    char *buf = GC_MALLOC_ATOMIC(len + 1);
+    if (buf == NULL) {
+        error("unable to allocate string buffer:");
+    }
+
+    if (!quotes) {
+        memcpy(buf, s, len);
+        buf[len] = '\0';
+        return make_string(buf);
+    }
+
+    char *out = buf;
+    quoted = 0;
+    for (char const *in = s; in < stop; in++) {
+        if (*in != '"') {
+            *out++ = *in;
+        } else if (quoted && in + 1 < stop && in[1] == '"') {
+            *out++ = '"';
+            in++;
+        } else {
+            quoted = !quoted;
+        }
+    }
+    *out = '\0';
+    return make_string(buf);
+}
+
+
+/* Reads the next row from port, and returns its fields as a vector of
+ * strings. Returns the end of file object if there are no more rows.
+ */
+object *csv_read_row(object *port)
+{
+    if (port_is_closed(port)) {
+        error("port is closed");
+    }
+    if (port_lookahead(port, 0) == EOF) {
+        return get_end_of_file();
+    }
+
+    long count;
+    size_t consumed;
+    size_t len = scan_row(port, &count, &consumed);
+
+    char const *s = port_position(port);
+    char const *end = s + len;
+    if (len > 0 && end[-1] == '\r') {
+        end--;
+    }
+
+    object *row = make_vector(count, get_empty_list());
+    for (long i = 0; i < count; i++) {
+        row->value.vector.items[i] = read_field(s, end, &s);
+    }
+
+    port_advance(port, consumed);
+    return row;
+}
+
+
+static void write_field(object *field, object *port)
+{
+    char buf[32];
+    char const *s;
+    if (is_string(field)) {
+        s = field->value.string;
+    } else if (is_symbol(field)) {
+        s = field->value.symbol;
+    } else if (is_number(field)) {
+        snprintf(buf, sizeof(buf), "%ld", field->value.number);
+        s = buf;
+    } else {
+        error("csv field is not a string, symbol or number");
+    }
+
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        write_port_bytes(port, s, strlen(s));
+        return;
+    }
+
+    // Quote the field, and double the quotes inside it.
+    write_port_bytes(port, "\"", 1);
+    char const *quote;
+    while ((quote = strchr(s, '"')) != NULL) {
+        write_port_bytes(port, s, (size_t)(quote - s) + 1);
+        write_port_bytes(port, "\"", 1);
+        s = quote + 1;
+    }
+    write_port_bytes(port, s, strlen(s));
+    write_port_bytes(port, "\"", 1);
+}
+
+
+/* Writes the fields of row, a vector or a proper list, to port as one line.
+ * Fields are quoted only if they need to be.
+ */
+void csv_write_row(object *row, object *port)
+{
+    if (is_vector(row)) {
+        for (long i = 0; i < row->value.vector.length; i++) {
+            if (i > 0) {
+                write_port_bytes(port, ",", 1);
+            }
+            write_field(row->value.vector.items[i], port);
+        }
+    } else {
+        for (object *rest = row; !is_empty_list(rest); rest = cdr(rest)) {
+            if (rest != row) {
+                write_port_bytes(port, ",", 1);
+            }
+            write_field(car(rest), port);
+        }
+    }
+    write_port_bytes(port, "\n", 1);
+}
+
@@ -0,0 +1,16 @@
+/* Reading and writing comma separated values.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef CSV_H
+#define CSV_H
+
+#include "object.h"
+
+object *csv_read_row(object *port);
+void csv_write_row(object *row, object *port);
+
+#endif
+
@@ -4,6 +4,7 @@
  * See the LICENSE file for terms of use.
  */
 
+#include "autoload.h"
 #include "environment.h"
 #include "error.h"
 #include "eval.h"
@@ -28,6 +29,9 @@ void init_global_environment(void)
 object *get_global_environment(void) { return global_environment; }
 
 
+void set_global_environment(object *env) { global_environment = env; }
+
+
 object *make_null_environment(void)
 {
     return extend_environment(get_empty_list(), get_empty_list(),
@@ -65,6 +69,9 @@ object *lookup_variable_value(object *var, object *env)
         while (!is_empty_list(frame)) {
             binding = car(frame);
             if (car(binding) == var) {
+                if (is_autoload(cdr(binding))) {
+                    run_autoload(binding);
+                }
                 return cdr(binding);
             }
             frame = cdr(frame);
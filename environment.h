@@ -11,6 +11,7 @@
 
 void init_global_environment(void);
 object *get_global_environment(void);
+void set_global_environment(object *env);
 object *make_null_environment(void);
 
 object *lookup_variable_value(object *var, object *env);
@@ -8,8 +8,10 @@
 #include <string.h>
 #include <errno.h>
 #include <stdarg.h>
+#include "gc.h"
 
 #include "error.h"
+#include "object.h"
 #include "port.h"
 
 #ifdef DEBUG
@@ -35,24 +37,106 @@ void set_error_level(error_level level)
 }
 
 
-void print_error(error_level level, char const * const file, int line,
-        char const * const func, char const * const fmt, ...)
+static void va_print_error(error_level level, char const * const file,
+        int line, char const * const func, char const * const fmt,
+        va_list args)
 {
     if (level > current_level)
         return;
 
-    (void)fflush(get_output_port()->value.port.file);
+    flush_port(get_output_port());
     write_error("%s\t%s:%d:%s: ", level_names[level], file, line, func);
+    va_write_error(fmt, args);
+
+    if (fmt[0] != '\0' && fmt[strlen(fmt) - 1] == ':') {
+        write_error(" %s", strerror(errno));
+    }
 
+    write_error("\n");
+}
+
+
+void print_error(error_level level, char const * const file, int line,
+        char const * const func, char const * const fmt, ...)
+{
     va_list arg_list;
     va_start(arg_list, fmt);
-    va_write_error(fmt, arg_list);
+    va_print_error(level, file, line, func, fmt, arg_list);
     va_end(arg_list);
+}
 
-    if (fmt[0] != '\0' && fmt[strlen(fmt) - 1] == ':') {
-        write_error(" %s", strerror(errno));
+
+static struct error_handler *handlers = NULL;
+
+
+void push_error_handler(struct error_handler *h)
+{
+    h->prev = handlers;
+    h->condition = NULL;
+    h->input_port = get_input_port();
+    h->output_port = get_output_port();
+    h->error_port = get_error_port();
+    handlers = h;
+}
+
+
+void pop_error_handler(struct error_handler *h)
+{
+    handlers = h->prev;
+}
+
+
+/* Passes obj to the innermost handler. Returns only if there isn't one.
+ */
+void raise_object(object *obj)
+{
+    struct error_handler *h = handlers;
+    if (h == NULL) {
+        return;
     }
 
-    write_error("\n");
+    handlers = h->prev;
+    set_input_port(h->input_port);
+    set_output_port(h->output_port);
+    set_error_port(h->error_port);
+    h->condition = obj;
+    longjmp(h->jump, 1);
 }
 
+
+/* Raises an error object whose message is made from fmt and the arguments
+ * after it, like print_error's. Prints the message instead if there is no
+ * handler, and returns.
+ */
+void raise_error(char const * const file, int line, char const * const func,
+        char const * const fmt, ...)
+{
+    va_list arg_list;
+    va_start(arg_list, fmt);
+    if (handlers == NULL) {
+        va_print_error(ERROR, file, line, func, fmt, arg_list);
+        va_end(arg_list);
+        return;
+    }
+
+    // The reason for a failed system call has to be saved before anything
+    // else can change errno.
+    char const *reason = strerror(errno);
+    char buffer[256];
+    vsnprintf(buffer, sizeof(buffer), fmt, arg_list);
+    va_end(arg_list);
+
+    size_t len = strlen(buffer);
+    if (fmt[0] != '\0' && fmt[strlen(fmt) - 1] == ':') {
+        snprintf(buffer + len, sizeof(buffer) - len, " %s", reason);
+        len = strlen(buffer);
+    }
+
+    char *message = GC_MALLOC_ATOMIC(len + 1);
+    if (message == NULL) {
+        message = "out of memory";
+    } else {
+        memcpy(message, buffer, len + 1);
+    }
+    raise_object(make_error_object(make_string(message), get_empty_list()));
+}
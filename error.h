@@ -8,6 +8,7 @@
 #define ERROR_H
 
 #include <stdlib.h>
+#include <setjmp.h>
 
 typedef enum {
     ERROR,
@@ -16,8 +17,12 @@ typedef enum {
 } error_level;
 
 
+/* Raises an error. If a handler is active, control goes to it with an error
+ * object holding the message. Otherwise, the message is printed and bs
+ * exits.
+ */
 #define error(...) do { \
-    print_error(ERROR, __FILE__, __LINE__, __func__, __VA_ARGS__); \
+    raise_error(__FILE__, __LINE__, __func__, __VA_ARGS__); \
     exit(EXIT_FAILURE); \
 } while (0)
 
@@ -30,6 +35,39 @@ typedef enum {
     print_error(INFO, __FILE__, __LINE__, __func__, __VA_ARGS__)
 
 
+/* Handlers form a stack, which lives on the C stack of the functions that
+ * push them. One is used like this:
+ *
+ *     struct error_handler h;
+ *     push_error_handler(&h);
+ *     if (setjmp(h.jump) == 0) {
+ *         ... code that may raise ...
+ *         pop_error_handler(&h);
+ *     } else {
+ *         ... h.condition is what was raised ...
+ *     }
+ *
+ * Raising pops the handler and restores the current ports before jumping to
+ * it, so the else branch runs as if the handler had never been pushed.
+ */
+struct object;
+
+struct error_handler {
+    jmp_buf jump;
+    struct error_handler *prev;
+    struct object *condition;
+    struct object *input_port;
+    struct object *output_port;
+    struct object *error_port;
+};
+
+void push_error_handler(struct error_handler *h);
+void pop_error_handler(struct error_handler *h);
+
+void raise_object(struct object *obj);
+void raise_error(char const * const file, int line, char const * const func,
+        char const * const fmt, ...);
+
 void set_error_level(error_level level);
 
 void print_error(error_level level, char const * const file, int line,
@@ -4,6 +4,8 @@
  * See the LICENSE file for terms of use.
  */
 
+#include <setjmp.h>
+
 #include "environment.h"
 #include "error.h"
 #include "eval.h"
@@ -24,6 +26,7 @@ static inline int is_lambda(object *exp);
 static inline int is_let(object *exp);
 static inline int is_and(object *exp);
 static inline int is_or(object *exp);
+static inline int is_guard(object *exp);
 static inline int is_application(object *exp);
 
 
@@ -77,15 +80,17 @@ static object *prepare_apply_operands(object *arguments);
 static object *eval_assignment(object *exp, object *env);
 static object *eval_definition(object *exp, object *env);
 static object *eval_parameters(object *parameters, object *env);
+static object *eval_guard(object *exp, object *env);
 
 extern object *apply_proc(object *arguments);   // from primitive.c
 extern object *eval_proc(object *arguments);    // from primitive.c
+extern object *raise_proc(object *arguments);   // from primitive.c
 
 /**** Identification ****/
 static inline int is_self_evaluating(object *exp)
 {
     return is_number(exp) || is_boolean(exp) || is_character(exp) ||
-        is_string(exp);
+        is_string(exp) || is_vector(exp);
 }
 
 
@@ -485,6 +490,71 @@ static object *eval_parameters(object *parameters, object *env)
 }
 
 
+static inline int is_guard(object *exp)
+{
+    return is_tagged_list(exp, lookup_symbol("guard"));
+}
+
+
+/* Evaluates (guard (var clause...) body...). If the body raises something,
+ * it is bound to var and the clauses are tried as in cond. When none of
+ * them apply, it is raised again.
+ */
+static object *eval_guard(object *exp, object *env)
+{
+    if (!is_pair(cdr(exp)) || !is_pair(car(cdr(exp))) ||
+            !is_symbol(car(car(cdr(exp))))) {
+        error("malformed guard expression");
+    }
+    object *var = car(car(cdr(exp)));
+    object *clauses = cdr(car(cdr(exp)));
+    object *body = cdr(cdr(exp));
+
+    struct error_handler h;
+    push_error_handler(&h);
+    if (setjmp(h.jump) == 0) {
+        object *result = bs_eval(make_begin(body), env);
+        pop_error_handler(&h);
+        return result;
+    }
+
+    // Copy the clauses, adding (else 'unmatched) if there's no else. The
+    // marker is a new pair, so no clause can return it.
+    object *unmatched = cons(get_empty_list(), get_empty_list());
+    object *head = get_empty_list(), *tail = NULL;
+    int has_else = 0;
+    for (object *c = clauses; is_pair(c); c = cdr(c)) {
+        object *pair = cons(car(c), get_empty_list());
+        if (tail == NULL) {
+            head = pair;
+        } else {
+            set_cdr(tail, pair);
+        }
+        tail = pair;
+        has_else = cond_predicate(car(c)) == lookup_symbol("else");
+    }
+    if (!has_else) {
+        object *fallback = cons(lookup_symbol("else"),
+                cons(cons(lookup_symbol("quote"),
+                        cons(unmatched, get_empty_list())), get_empty_list()));
+        object *pair = cons(fallback, get_empty_list());
+        if (tail == NULL) {
+            head = pair;
+        } else {
+            set_cdr(tail, pair);
+        }
+    }
+
+    object *handler_env = extend_environment(cons(var, get_empty_list()),
+            cons(h.condition, get_empty_list()), env);
+    object *result = bs_eval(expand_clauses(head), handler_env);
+    if (result == unmatched) {
+        return raise_proc(cons(h.condition, get_empty_list()));
+    }
+    return result;
+}
+
+
 object *bs_eval(object *exp, object *env)
 {
 tailcall:
@@ -558,6 +628,8 @@ tailcall:
         }
         exp = car(exp);
         goto tailcall;
+    } else if (is_guard(exp)) {
+        return eval_guard(exp, env);
     } else if (is_application(exp)) {
         object *procedure = bs_eval(application_operator(exp), env);
         object *parameters = eval_parameters(application_operands(exp), env);
@@ -595,6 +667,32 @@ tailcall:
 }
 
 
+/* Applies procedure to a list of arguments that have already been evaluated.
+ * This is how primitives call the procedures they are passed.
+ */
+object *bs_apply(object *procedure, object *arguments)
+{
+    if (is_primitive_proc(procedure)) {
+        if (procedure->value.primitive_proc == eval_proc) {
+            return bs_eval(eval_expression(arguments),
+                    eval_environment(arguments));
+        } else if (procedure->value.primitive_proc == apply_proc) {
+            return bs_apply(apply_operator(arguments),
+                    apply_operands(arguments));
+        }
+        return (procedure->value.primitive_proc)(arguments);
+    } else if (is_compound_proc(procedure)) {
+        object *env = extend_environment(
+                procedure->value.compound_proc.parameters,
+                arguments,
+                procedure->value.compound_proc.env);
+        return bs_eval(make_begin(procedure->value.compound_proc.body), env);
+    } else {
+        error("unable to apply unknown procedure type");
+    }
+}
+
+
 void init_special_forms(void)
 {
     make_symbol("quote");
@@ -609,5 +707,7 @@ void init_special_forms(void)
     make_symbol("let");
     make_symbol("and");
     make_symbol("or");
+    make_symbol("guard");
+    make_symbol("raise");
 }
 
@@ -10,6 +10,7 @@
 #include "object.h"
 
 object *bs_eval(object *exp, object *env);
+object *bs_apply(object *procedure, object *arguments);
 void init_special_forms(void);
 
 #define EVAL_H
@@ -0,0 +1,843 @@
+/* Binary serialization of data.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "gc.h"
+
+#include "environment.h"
+#include "error.h"
+#include "fasl.h"
+#include "object.h"
+#include "port.h"
+#include "primitive.h"
+#include "table.h"
+
+/* A fasl record is laid out as follows. All counts, lengths and indices are
+ * unsigned LEB128 varints, and numbers are zigzag encoded varints.
+ *
+ *     magic       "BSF" and a version byte
+ *     length      size in bytes of everything after this field
+ *     symbols     count, then the length and bytes of each symbol's name
+ *     datum       a tagged object stream, in depth first order
+ *
+ * Every pair, vector and string in the stream is numbered in the order it
+ * appears, and later occurrences of it are written as a reference to that
+ * number, so shared and circular structure survives the round trip. Because
+ * the length is known up front, a record is decoded straight out of the port
+ * buffer, which for files is the file's memory mapping.
+ *
+ * Images may also contain procedures and the standard ports. Primitive
+ * procedures are written by name, and compound procedures as their
+ * parameters, body and environment. Library definitions that have not been
+ * autoloaded yet are written as their source text.
+ */
+#define FASL_MAGIC "BSF\001"
+#define FASL_MAGIC_SIZE 4
+
+enum fasl_tag {
+    FASL_EMPTY_LIST,
+    FASL_FALSE,
+    FASL_TRUE,
+    FASL_NUMBER,
+    FASL_CHARACTER,
+    FASL_STRING,
+    FASL_SYMBOL,
+    FASL_PAIR,
+    FASL_REF,
+    FASL_END_OF_FILE,
+    FASL_PRIMITIVE_PROC,
+    FASL_COMPOUND_PROC,
+    FASL_STANDARD_PORT,
+    FASL_AUTOLOAD,
+    FASL_VECTOR
+};
+
+
+/* The primitive procedures, as a frame of (name . procedure) bindings. Images
+ * refer to primitives by name, through this frame.
+ */
+static object *primitives = NULL;
+
+static object *get_primitives(void)
+{
+    if (primitives == NULL) {
+        object *env = make_null_environment();
+        init_primitives(env);
+        primitives = car(env);
+    }
+    return primitives;
+}
+
+
+/**** Writing ****/
+
+struct fasl_buffer {
+    unsigned char *data;
+    size_t len, size;
+};
+
+static void put_bytes(struct fasl_buffer *b, void const *bytes, size_t len)
+{
+    if (b->len + len > b->size) {
+        while (b->len + len > b->size) {
+            b->size = b->size == 0 ? 256 : b->size * 2;
+        }
+        b->data = GC_REALLOC(b->data, b->size);
+        if (b->data == NULL) {
+            error("unable to grow fasl buffer:");
+        }
+    }
+    memcpy(b->data + b->len, bytes, len);
+    b->len += len;
+}
+
+
+static void put_byte(struct fasl_buffer *b, unsigned char byte)
+{
+    put_bytes(b, &byte, 1);
+}
+
+
+static void put_varint(struct fasl_buffer *b, unsigned long n)
+{
+    unsigned char bytes[16];
+    size_t len = 0;
+    do {
+        bytes[len] = (unsigned char)(n & 0x7f);
+        n >>= 7;
+        if (n != 0) {
+            bytes[len] |= 0x80;
+        }
+        len++;
+    } while (n != 0);
+    put_bytes(b, bytes, len);
+}
+
+
+struct fasl_writer {
+    struct fasl_buffer symbols;
+    struct fasl_buffer stream;
+    struct object_table *indices;   // object to its index + 1
+    unsigned long symbol_count;
+    unsigned long object_count;
+    int image;                      // procedures and ports may be written
+};
+
+
+/* Writes a reference to obj and returns true if obj has been written before.
+ * Otherwise numbers it and returns false.
+ */
+static int put_reference(struct fasl_writer *w, object *obj)
+{
+    long index = object_table_get(w->indices, obj);
+    if (index > 0) {
+        put_byte(&w->stream, FASL_REF);
+        put_varint(&w->stream, (unsigned long)(index - 1));
+        return 1;
+    }
+    object_table_put(w->indices, obj, (long)++w->object_count);
+    return 0;
+}
+
+
+static unsigned long symbol_index(struct fasl_writer *w, object *sym)
+{
+    long index = object_table_get(w->indices, sym);
+    if (index == 0) {
+        index = (long)++w->symbol_count;
+        object_table_put(w->indices, sym, index);
+
+        size_t len = strlen(sym->value.symbol);
+        put_varint(&w->symbols, len);
+        put_bytes(&w->symbols, sym->value.symbol, len);
+    }
+    return (unsigned long)(index - 1);
+}
+
+
+static object *primitive_name(object *proc)
+{
+    for (object *frame = get_primitives(); !is_empty_list(frame);
+            frame = cdr(frame)) {
+        if (cdr(car(frame))->value.primitive_proc ==
+                proc->value.primitive_proc) {
+            return car(car(frame));
+        }
+    }
+    error("unable to serialize an unknown primitive procedure");
+}
+
+
+static int standard_port_number(object *port)
+{
+    if (port == get_standard_input_port()) {
+        return 0;
+    } else if (port == get_standard_output_port()) {
+        return 1;
+    } else if (port == get_standard_error_port()) {
+        return 2;
+    }
+    return -1;
+}
+
+
+/* Encodes exp into the writer's stream. Pairs are taken apart on an explicit
+ * stack, car first, so neither long nor deep structure uses the C stack.
+ */
+static void encode(struct fasl_writer *w, object *exp)
+{
+    size_t count = 0, size = 64;
+    object **stack = GC_MALLOC(size * sizeof(object *));
+    if (stack == NULL) {
+        error("unable to allocate fasl stack:");
+    }
+
+    stack[count++] = exp;
+    while (count > 0) {
+        object *obj = stack[--count];
+
+        if (is_empty_list(obj)) {
+            put_byte(&w->stream, FASL_EMPTY_LIST);
+        } else if (is_boolean(obj)) {
+            put_byte(&w->stream, is_false(obj) ? FASL_FALSE : FASL_TRUE);
+        } else if (is_number(obj)) {
+            long n = obj->value.number;
+            put_byte(&w->stream, FASL_NUMBER);
+            put_varint(&w->stream, n < 0 ? (~(unsigned long)n << 1) | 1
+                                         : (unsigned long)n << 1);
+        } else if (is_character(obj)) {
+            put_byte(&w->stream, FASL_CHARACTER);
+            put_byte(&w->stream, (unsigned char)obj->value.character);
+        } else if (is_symbol(obj)) {
+            put_byte(&w->stream, FASL_SYMBOL);
+            put_varint(&w->stream, symbol_index(w, obj));
+        } else if (is_end_of_file(obj)) {
+            put_byte(&w->stream, FASL_END_OF_FILE);
+        } else if (is_string(obj)) {
+            if (!put_reference(w, obj)) {
+                size_t len = strlen(obj->value.string);
+                put_byte(&w->stream, FASL_STRING);
+                put_varint(&w->stream, len);
+                put_bytes(&w->stream, obj->value.string, len);
+            }
+        } else if (w->image && is_primitive_proc(obj)) {
+            if (!put_reference(w, obj)) {
+                unsigned long name = symbol_index(w, primitive_name(obj));
+                put_byte(&w->stream, FASL_PRIMITIVE_PROC);
+                put_varint(&w->stream, name);
+            }
+        } else if (w->image && is_autoload(obj)) {
+            size_t len = strlen(obj->value.autoload);
+            put_byte(&w->stream, FASL_AUTOLOAD);
+            put_varint(&w->stream, len);
+            put_bytes(&w->stream, obj->value.autoload, len);
+        } else if (w->image && is_port(obj) && standard_port_number(obj) >= 0) {
+            put_byte(&w->stream, FASL_STANDARD_PORT);
+            put_byte(&w->stream, (unsigned char)standard_port_number(obj));
+        } else if (is_vector(obj)) {
+            if (put_reference(w, obj)) {
+                continue;
+            }
+            long length = obj->value.vector.length;
+            put_byte(&w->stream, FASL_VECTOR);
+            put_varint(&w->stream, (unsigned long)length);
+            while (count + (size_t)length > size) {
+                size *= 2;
+                stack = GC_REALLOC(stack, size * sizeof(object *));
+                if (stack == NULL) {
+                    error("unable to grow fasl stack:");
+                }
+            }
+            for (long i = length - 1; i >= 0; i--) {
+                stack[count++] = obj->value.vector.items[i];
+            }
+        } else if (is_pair(obj) || (w->image && is_compound_proc(obj))) {
+            if (put_reference(w, obj)) {
+                continue;
+            }
+            if (count + 3 > size) {
+                size *= 2;
+                stack = GC_REALLOC(stack, size * sizeof(object *));
+                if (stack == NULL) {
+                    error("unable to grow fasl stack:");
+                }
+            }
+            if (is_pair(obj)) {
+                put_byte(&w->stream, FASL_PAIR);
+                stack[count++] = cdr(obj);
+                stack[count++] = car(obj);
+            } else {
+                put_byte(&w->stream, FASL_COMPOUND_PROC);
+                stack[count++] = obj->value.compound_proc.env;
+                stack[count++] = obj->value.compound_proc.body;
+                stack[count++] = obj->value.compound_proc.parameters;
+            }
+        } else {
+            error("unable to serialize procedures or ports");
+        }
+    }
+}
+
+
+static void write_record(object *exp, int image)
+{
+    struct fasl_writer w;
+    memset(&w, 0, sizeof(w));
+    w.indices = make_object_table();
+    w.image = image;
+
+    encode(&w, exp);
+
+    struct fasl_buffer header = { NULL, 0, 0 };
+    struct fasl_buffer count = { NULL, 0, 0 };
+    put_varint(&count, w.symbol_count);
+    put_bytes(&header, FASL_MAGIC, FASL_MAGIC_SIZE);
+    put_varint(&header, count.len + w.symbols.len + w.stream.len);
+
+    write_output_bytes((char const *)header.data, header.len);
+    write_output_bytes((char const *)count.data, count.len);
+    if (w.symbols.len > 0) {
+        write_output_bytes((char const *)w.symbols.data, w.symbols.len);
+    }
+    write_output_bytes((char const *)w.stream.data, w.stream.len);
+}
+
+
+/* Writes exp to the current output port as a single fasl record.
+ */
+void fasl_write(object *exp)
+{
+    write_record(exp, 0);
+}
+
+
+/**** Reading ****/
+
+struct fasl_reader {
+    unsigned char const *pos, *end;
+    object **symbols;
+    unsigned long symbol_count;
+    object **objects;               // pairs, vectors, strings and procedures
+    unsigned long object_count, object_size;
+    int image;
+};
+
+
+static unsigned char get_byte(struct fasl_reader *r)
+{
+    if (r->pos == r->end) {
+        error("fasl record is truncated");
+    }
+    return *r->pos++;
+}
+
+
+static unsigned long get_varint(struct fasl_reader *r)
+{
+    unsigned long n = 0;
+    unsigned shift = 0;
+    unsigned char byte;
+    do {
+        if (shift >= 8 * sizeof(n)) {
+            error("fasl record has a malformed number");
+        }
+        byte = get_byte(r);
+        n |= (unsigned long)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return n;
+}
+
+
+/* Returns a new copy of the next len bytes, with a terminating nul.
+ */
+static char *get_text(struct fasl_reader *r, unsigned long len)
+{
+    if (len > (unsigned long)(r->end - r->pos)) {
+        error("fasl record is truncated");
+    }
+    char *text = GC_MALLOC_ATOMIC(len + 1);
+    if (text == NULL) {
+        error("unable to allocate fasl text:");
+    }
+    memcpy(text, r->pos, len);
+    text[len] = '\0';
+    r->pos += len;
+    return text;
+}
+
+
+static void read_symbols(struct fasl_reader *r)
+{
+    r->symbol_count = get_varint(r);
+    if (r->symbol_count > (unsigned long)(r->end - r->pos)) {
+        error("fasl record is truncated");
+    }
+    r->symbols = GC_MALLOC((r->symbol_count + 1) * sizeof(object *));
+    if (r->symbols == NULL) {
+        error("unable to allocate fasl symbol table:");
+    }
+
+    for (unsigned long i = 0; i < r->symbol_count; i++) {
+        unsigned long len = get_varint(r);
+        if (len > (unsigned long)(r->end - r->pos)) {
+            error("fasl record has a malformed symbol");
+        }
+
+        char scratch[128];
+        if (len < sizeof(scratch)) {
+            memcpy(scratch, r->pos, len);
+            scratch[len] = '\0';
+            object *sym = lookup_symbol(scratch);
+            if (sym != NULL) {
+                r->symbols[i] = sym;
+                r->pos += len;
+                continue;
+            }
+        }
+        r->symbols[i] = make_symbol(get_text(r, len));
+    }
+}
+
+
+static void add_object(struct fasl_reader *r, object *obj)
+{
+    if (r->object_count == r->object_size) {
+        r->object_size = r->object_size == 0 ? 64 : r->object_size * 2;
+        r->objects = GC_REALLOC(r->objects,
+                r->object_size * sizeof(object *));
+        if (r->objects == NULL) {
+            error("unable to grow fasl object table:");
+        }
+    }
+    r->objects[r->object_count++] = obj;
+}
+
+
+static object *get_symbol(struct fasl_reader *r)
+{
+    unsigned long n = get_varint(r);
+    if (n >= r->symbol_count) {
+        error("fasl record refers to an unknown symbol");
+    }
+    return r->symbols[n];
+}
+
+
+/* Decodes one datum. Pairs, vectors and procedures are allocated as soon as
+ * they are seen, so that references to them can be resolved while their
+ * fields are decoded, and the fields still to be filled are kept on an
+ * explicit stack.
+ */
+static object *decode(struct fasl_reader *r)
+{
+    object *result = NULL;
+    size_t count = 0, size = 64;
+    object ***stack = GC_MALLOC(size * sizeof(object **));
+    if (stack == NULL) {
+        error("unable to allocate fasl stack:");
+    }
+
+    stack[count++] = &result;
+    while (count > 0) {
+        object **field = stack[--count];
+        object *obj;
+        unsigned long n;
+
+        if (count + 3 > size) {
+            size *= 2;
+            stack = GC_REALLOC(stack, size * sizeof(object **));
+            if (stack == NULL) {
+                error("unable to grow fasl stack:");
+            }
+        }
+
+        switch (get_byte(r)) {
+            case FASL_EMPTY_LIST:
+                obj = get_empty_list();
+                break;
+            case FASL_FALSE:
+                obj = get_boolean(0);
+                break;
+            case FASL_TRUE:
+                obj = get_boolean(1);
+                break;
+            case FASL_NUMBER:
+                n = get_varint(r);
+                obj = make_number((n & 1) ? -(long)(n >> 1) - 1
+                                          : (long)(n >> 1));
+                break;
+            case FASL_CHARACTER:
+                obj = make_character((char)get_byte(r));
+                break;
+            case FASL_STRING:
+                obj = make_string(get_text(r, get_varint(r)));
+                add_object(r, obj);
+                break;
+            case FASL_SYMBOL:
+                obj = get_symbol(r);
+                break;
+            case FASL_PAIR:
+                obj = cons(get_empty_list(), get_empty_list());
+                add_object(r, obj);
+                stack[count++] = &obj->value.pair.cdr;
+                stack[count++] = &obj->value.pair.car;
+                break;
+            case FASL_VECTOR:
+                n = get_varint(r);
+                if (n > (unsigned long)(r->end - r->pos)) {
+                    error("fasl record is truncated");
+                }
+                obj = make_vector((long)n, get_empty_list());
+                add_object(r, obj);
+                while (count + n + 3 > size) {
+                    size *= 2;
+                    stack = GC_REALLOC(stack, size * sizeof(object **));
+                    if (stack == NULL) {
+                        error("unable to grow fasl stack:");
+                    }
+                }
+                for (unsigned long i = n; i > 0; i--) {
+                    stack[count++] = &obj->value.vector.items[i - 1];
+                }
+                break;
+            case FASL_REF:
+                n = get_varint(r);
+                if (n >= r->object_count) {
+                    error("fasl record refers to an unknown object");
+                }
+                obj = r->objects[n];
+                break;
+            case FASL_END_OF_FILE:
+                obj = get_end_of_file();
+                break;
+            case FASL_PRIMITIVE_PROC:
+                if (!r->image) {
+                    error("fasl record contains a procedure");
+                }
+                obj = lookup_variable_value(get_symbol(r),
+                        cons(get_primitives(), get_empty_list()));
+                add_object(r, obj);
+                break;
+            case FASL_COMPOUND_PROC:
+                if (!r->image) {
+                    error("fasl record contains a procedure");
+                }
+                obj = make_compound_proc(get_empty_list(), get_empty_list(),
+                        get_empty_list());
+                add_object(r, obj);
+                stack[count++] = &obj->value.compound_proc.env;
+                stack[count++] = &obj->value.compound_proc.body;
+                stack[count++] = &obj->value.compound_proc.parameters;
+                break;
+            case FASL_STANDARD_PORT:
+                if (!r->image) {
+                    error("fasl record contains a port");
+                }
+                n = get_byte(r);
+                if (n == 0) {
+                    obj = get_standard_input_port();
+                } else if (n == 1) {
+                    obj = get_standard_output_port();
+                } else if (n == 2) {
+                    obj = get_standard_error_port();
+                } else {
+                    error("fasl record refers to an unknown port");
+                }
+                break;
+            case FASL_AUTOLOAD:
+                if (!r->image) {
+                    error("fasl record contains an autoload");
+                }
+                obj = make_autoload(get_text(r, get_varint(r)));
+                break;
+            default:
+                error("fasl record has an unknown tag");
+        }
+
+        *field = obj;
+    }
+
+    return result;
+}
+
+
+static object *read_record(object *port, int image)
+{
+    if (port_is_closed(port)) {
+        error("port is closed");
+    }
+
+    if (port_lookahead(port, 0) == EOF) {
+        return get_end_of_file();
+    }
+    for (size_t i = 0; i < FASL_MAGIC_SIZE; i++) {
+        if (port_lookahead(port, i) != (unsigned char)FASL_MAGIC[i]) {
+            error("not a fasl record");
+        }
+    }
+
+    // The length field is read a byte at a time, since the whole record is
+    // not yet known to be in the buffer.
+    size_t offset = FASL_MAGIC_SIZE;
+    unsigned long len = 0;
+    unsigned shift = 0;
+    int c;
+    do {
+        c = port_lookahead(port, offset++);
+        if (c == EOF || shift >= 8 * sizeof(len)) {
+            error("fasl record is truncated");
+        }
+        len |= (unsigned long)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    if (len == 0 || len > SIZE_MAX - offset ||
+            port_lookahead(port, offset + len - 1) == EOF) {
+        error("fasl record is truncated");
+    }
+
+    struct fasl_reader r;
+    memset(&r, 0, sizeof(r));
+    r.pos = (unsigned char const *)port_position(port) + offset;
+    r.end = r.pos + len;
+    r.image = image;
+
+    read_symbols(&r);
+    object *obj = decode(&r);
+    if (r.pos != r.end) {
+        error("fasl record has trailing bytes");
+    }
+
+    port_advance(port, offset + len);
+    return obj;
+}
+
+
+/* Reads the next fasl record from port. Returns the end of file object if
+ * there are no more records.
+ */
+object *fasl_read(object *port)
+{
+    return read_record(port, 0);
+}
+
+
+/**** Load cache ****/
+
+/* load keeps the forms it reads from a file in a cache file next to it, with
+ * ".bsc" appended to the name. The cache is a fasl record holding the key
+ * (path mtime-seconds mtime-nanoseconds size) of the source file it was made
+ * from, followed by one fasl record for each form in the file.
+ */
+#define CACHE_SUFFIX ".bsc"
+
+
+static char *cache_file_name(char const *file)
+{
+    size_t len = strlen(file);
+    char *name = GC_MALLOC_ATOMIC(len + sizeof(CACHE_SUFFIX));
+    if (name == NULL) {
+        error("unable to allocate file name:");
+    }
+    memcpy(name, file, len);
+    memcpy(name + len, CACHE_SUFFIX, sizeof(CACHE_SUFFIX));
+    return name;
+}
+
+
+/* Returns the cache key of file, or NULL if file is not a regular file.
+ */
+static object *make_cache_key(char const *file)
+{
+    struct stat st;
+    if (stat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+
+    // Key on the canonical path where possible, so that the same file
+    // loaded by different names shares a cache.
+    char *path = realpath(file, NULL);
+    char const *source = path == NULL ? file : path;
+    char *copy = GC_MALLOC_ATOMIC(strlen(source) + 1);
+    if (copy == NULL) {
+        error("unable to allocate file name:");
+    }
+    strcpy(copy, source);
+    free(path);
+    object *name = make_string(copy);
+
+    return cons(name,
+           cons(make_number((long)st.st_mtim.tv_sec),
+           cons(make_number(st.st_mtim.tv_nsec),
+           cons(make_number((long)st.st_size), get_empty_list()))));
+}
+
+
+static int cache_key_matches(object *key, object *cached)
+{
+    if (!is_pair(cached) || !is_string(car(cached)) ||
+            strcmp(car(key)->value.string, car(cached)->value.string) != 0) {
+        return 0;
+    }
+
+    for (key = cdr(key), cached = cdr(cached); is_pair(key);
+            key = cdr(key), cached = cdr(cached)) {
+        if (!is_pair(cached) || !is_number(car(cached)) ||
+                car(cached)->value.number != car(key)->value.number) {
+            return 0;
+        }
+    }
+    return is_empty_list(cached);
+}
+
+
+/* Reads the forms cached for file, if it has an up to date cache, and
+ * returns them as a list. Otherwise returns NULL, and stores in key the key
+ * to pass to save_load_cache, which is NULL if file can't be cached.
+ *
+ * Every record is decoded before any form is returned, so a cache that can't
+ * be opened, or is truncated or corrupt anywhere, is treated the same as a
+ * stale one, and replaced when file is loaded.
+ */
+object *read_load_cache(char const *file, object **key)
+{
+    *key = make_cache_key(file);
+    if (*key == NULL) {
+        return NULL;
+    }
+
+    char const *name = cache_file_name(file);
+    if (access(name, R_OK) != 0) {
+        return NULL;
+    }
+
+    object *volatile port = NULL;
+    object *volatile forms = NULL;
+    struct error_handler h;
+    push_error_handler(&h);
+    if (setjmp(h.jump) == 0) {
+        port = make_input_port(name);
+        if (cache_key_matches(*key, fasl_read(port))) {
+            object *head = get_empty_list(), *tail = NULL;
+            object *obj;
+            while (!is_end_of_file(obj = fasl_read(port))) {
+                object *pair = cons(obj, get_empty_list());
+                if (tail == NULL) {
+                    head = pair;
+                } else {
+                    set_cdr(tail, pair);
+                }
+                tail = pair;
+            }
+            forms = head;
+        }
+        pop_error_handler(&h);
+    }
+
+    if (port != NULL) {
+        close_port(port);
+    }
+    return forms;
+}
+
+
+static int write_bytes(int fd, char const *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+
+/* Saves the fasl records of the forms of file, which have been written to the
+ * string port forms, as its cache. The cache is written to a temporary file
+ * that is then renamed, so a reader never sees half of one. If the cache
+ * can't be written, for example because the directory is read only, nothing
+ * happens.
+ */
+void save_load_cache(char const *file, object *key, object *forms)
+{
+    object *header = make_output_string_port();
+    object *prev_port = get_output_port();
+    set_output_port(header);
+    fasl_write(key);
+    set_output_port(prev_port);
+
+    char const *name = cache_file_name(file);
+    char *temp = GC_MALLOC_ATOMIC(strlen(name) + sizeof(".XXXXXX"));
+    if (temp == NULL) {
+        error("unable to allocate file name:");
+    }
+    strcpy(temp, name);
+    strcat(temp, ".XXXXXX");
+
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        return;
+    }
+
+    struct port_buffer *h = header->value.port.buffer;
+    struct port_buffer *f = forms->value.port.buffer;
+    int ok = fchmod(fd, 0644) == 0 &&
+        write_bytes(fd, h->data, h->end) &&
+        write_bytes(fd, f->data, f->end);
+    ok = close(fd) == 0 && ok;
+
+    if (!ok || rename(temp, name) != 0) {
+        unlink(temp);
+    }
+}
+
+
+/**** Images ****/
+
+/* An image is a fasl record of the list (bs-image environment), where
+ * environment is the global environment, with everything reachable from it.
+ */
+void dump_image(char const *file)
+{
+    object *port = make_output_port(file);
+    object *prev_port = get_output_port();
+    set_output_port(port);
+    write_record(cons(make_symbol("bs-image"),
+                cons(get_global_environment(), get_empty_list())), 1);
+    set_output_port(prev_port);
+    close_port(port);
+}
+
+
+/* Replaces the global environment with the one saved in the image file.
+ */
+void load_image(char const *file)
+{
+    object *port = make_input_port(file);
+    object *image = read_record(port, 1);
+    close_port(port);
+
+    if (!is_pair(image) || car(image) != lookup_symbol("bs-image") ||
+            !is_pair(cdr(image)) || !is_pair(car(cdr(image)))) {
+        error("%s is not a bs image", file);
+    }
+    set_global_environment(car(cdr(image)));
+}
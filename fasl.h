@@ -0,0 +1,22 @@
+/* Binary serialization of data.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef FASL_H
+#define FASL_H
+
+#include "object.h"
+
+void fasl_write(object *exp);
+object *fasl_read(object *port);
+
+object *read_load_cache(char const *file, object **key);
+void save_load_cache(char const *file, object *key, object *forms);
+
+void dump_image(char const *file);
+void load_image(char const *file);
+
+#endif
+
@@ -0,0 +1,575 @@
+/* Reading and writing JSON.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "gc.h"
+
+#include "error.h"
+#include "json.h"
+#include "object.h"
+#include "port.h"
+#include "table.h"
+
+/* JSON values are read as the following data:
+ *
+ *     object          an association list, with the keys as symbols
+ *     array           a vector
+ *     string          a string, with \u escapes encoded as UTF-8
+ *     number          a number; only integers are supported
+ *     true, false     #t and #f
+ *     null            the symbol null
+ *
+ * The writer takes the same data, and also writes other symbols as strings.
+ *
+ * Strings are scanned in place in the port buffer, the way the lexer scans
+ * them, and copied out once. Nested arrays and objects are read and written
+ * with explicit stacks, so deep nesting can't overflow the C stack.
+ */
+
+
+/* While reading, the values of all open arrays and objects are kept on a
+ * single stack. An object's keys and values alternate on it. Each open
+ * array or object has a frame, which records where its values start.
+ */
+struct json_frame {
+    char close;     // the character that closes it, ']' or '}'
+    size_t base;
+};
+
+struct json_reader {
+    object **values;
+    size_t count, size;
+    struct json_frame *frames;
+    size_t depth, frames_size;
+};
+
+
+#define JSON_STACK_SIZE 64
+
+
+static void push_value(struct json_reader *r, object *value)
+{
+    if (r->count == r->size) {
+        r->size = r->size == 0 ? JSON_STACK_SIZE : r->size * 2;
+        r->values = GC_REALLOC(r->values, r->size * sizeof(object *));
+        if (r->values == NULL) {
+            error("unable to grow json stack:");
+        }
+    }
+    r->values[r->count++] = value;
+}
+
+
+static void push_frame(struct json_reader *r, char close)
+{
+    if (r->depth == r->frames_size) {
+        r->frames_size = r->frames_size == 0 ?
+            JSON_STACK_SIZE : r->frames_size * 2;
+        r->frames = GC_REALLOC(r->frames,
+                r->frames_size * sizeof(struct json_frame));
+        if (r->frames == NULL) {
+            error("unable to grow json stack:");
+        }
+    }
+    r->frames[r->depth].close = close;
+    r->frames[r->depth].base = r->count;
+    r->depth++;
+}
+
+
+/* Closes the innermost array or object, and returns it.
+ */
+static object *pop_frame(struct json_reader *r)
+{
+    struct json_frame frame = r->frames[--r->depth];
+    object **values = r->values + frame.base;
+    size_t count = r->count - frame.base;
+    r->count = frame.base;
+
+    if (frame.close == ']') {
+        object *v = make_vector((long)count, get_empty_list());
+        memcpy(v->value.vector.items, values, count * sizeof(object *));
+        return v;
+    }
+
+    object *alist = get_empty_list();
+    for (size_t i = count; i > 0; i -= 2) {
+        alist = cons(cons(values[i - 2], values[i - 1]), alist);
+    }
+    return alist;
+}
+
+
+/* Skips whitespace, and returns the next character without consuming it.
+ */
+static int skip_space(object *port)
+{
+    int c = port_lookahead(port, 0);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        port_advance(port, 1);
+        c = port_lookahead(port, 0);
+    }
+    return c;
+}
+
+
+/* Consumes the character at the read position of port, if there is one.
+ * Syntax errors are raised after the bad input is consumed, so that reading
+ * again goes on after it instead of failing at the same place.
+ */
+static void skip_char(object *port)
+{
+    if (port_lookahead(port, 0) != EOF) {
+        port_advance(port, 1);
+    }
+}
+
+
+/* Consumes the rest of a malformed number or literal.
+ */
+static void skip_word(object *port)
+{
+    int c = port_lookahead(port, 0);
+    while ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+            (c >= 'A' && c <= 'Z') || c == '.' || c == '+' || c == '-') {
+        port_advance(port, 1);
+        c = port_lookahead(port, 0);
+    }
+}
+
+
+static void expect(object *port, int c)
+{
+    if (skip_space(port) != c) {
+        skip_char(port);
+        error("json syntax error: expected '%c'", c);
+    }
+    port_advance(port, 1);
+}
+
+
+static int hex_value(char const *s)
+{
+    int value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = s[i];
+        value *= 16;
+        if (c >= '0' && c <= '9') {
+            value += c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value += c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value += c - 'A' + 10;
+        } else {
+            error("json syntax error: malformed \\u escape");
+        }
+    }
+    return value;
+}
+
+
+static char *put_utf8(char *out, long code)
+{
+    if (code < 0x80) {
+        *out++ = (char)code;
+    } else if (code < 0x800) {
+        *out++ = (char)(0xc0 | (code >> 6));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+        *out++ = (char)(0xe0 | (code >> 12));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    } else {
+        *out++ = (char)(0xf0 | (code >> 18));
+        *out++ = (char)(0x80 | ((code >> 12) & 0x3f));
+        *out++ = (char)(0x80 | ((code >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (code & 0x3f));
+    }
+    return out;
+}
+
+
+/* Decodes the len bytes of escaped string contents at in into out, which
+ * has room for at least len bytes. No escape decodes to more bytes than it
+ * takes up.
+ */
+static void decode_escapes(char const *in, size_t len, char *out)
+{
+    char const *end = in + len;
+    while (in < end) {
+        if (*in != '\\') {
+            *out++ = *in++;
+            continue;
+        }
+
+        in++;
+        switch (*in++) {
+        case '"':  *out++ = '"';  break;
+        case '\\': *out++ = '\\'; break;
+        case '/':  *out++ = '/';  break;
+        case 'b':  *out++ = '\b'; break;
+        case 'f':  *out++ = '\f'; break;
+        case 'n':  *out++ = '\n'; break;
+        case 'r':  *out++ = '\r'; break;
+        case 't':  *out++ = '\t'; break;
+        case 'u': {
+            if (end - in < 4) {
+                error("json syntax error: malformed \\u escape");
+            }
+            long code = hex_value(in);
+            in += 4;
+            // A surrogate pair is two escapes for one character.
+            if (code >= 0xd800 && code < 0xdc00 && end - in >= 6 &&
+                    in[0] == '\\' && in[1] == 'u') {
+                long low = hex_value(in + 2);
+                if (low >= 0xdc00 && low < 0xe000) {
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    in += 6;
+                }
+            }
+            // Strings end at a nul, so one can't be read into them.
+            if (code == 0) {
+                error("json syntax error: strings can't contain a nul");
+            }
+            out = put_utf8(out, code);
+            break;
+        }
+        default:
+            error("json syntax error: unrecognized escape \\%c", in[-1]);
+        }
+    }
+    *out = '\0';
+}
+
+
+/* Reads the string at the read position of port, which starts with a
+ * double quote.
+ */
+static char *read_string(object *port)
+{
+    struct port_buffer *b = port->value.port.buffer;
+    size_t len = 1;
+    int escapes = 0;
+    for (;;) {
+        if (port_lookahead(port, len) == EOF) {
+            port_advance(port, len);
+            error("end of file inside a json string");
+        }
+        char const *start = port_position(port);
+        char const *end = b->data + b->end;
+        char const *s = start + len;
+        while (s < end && *s != '"' && *s != '\\') {
+            s++;
+        }
+        len = (size_t)(s - start);
+        if (s == end) {
+            continue;
+        } else if (*s == '"') {
+            break;
+        }
+        // Skip the backslash and the character after it.
+        escapes = 1;
+        len += 2;
+    }
+
+    // The string is consumed before its escapes are decoded, so a bad one
+    // is skipped. Its contents stay in the buffer until the next lookahead.
+    char const *contents = port_position(port) + 1;
+    size_t contents_len = len - 1;
+    port_advance(port, len + 1);
+
+    char *buf = GC_MALLOC_ATOMIC(contents_len + 1);
+    if (buf == NULL) {
+        error("unable to allocate string buffer:");
+    }
+    if (escapes) {
+        decode_escapes(contents, contents_len, buf);
+    } else {
+        memcpy(buf, contents, contents_len);
+        buf[contents_len] = '\0';
+    }
+    return buf;
+}
+
+
+static object *read_number(object *port)
+{
+    int negative = port_lookahead(port, 0) == '-';
+    if (negative) {
+        port_advance(port, 1);
+    }
+
+    int c = port_lookahead(port, 0);
+    if (c < '0' || c > '9') {
+        skip_word(port);
+        error("json syntax error: malformed number");
+    }
+
+    long n = 0;
+    while (c >= '0' && c <= '9') {
+        int digit = c - '0';
+        if (n > (LONG_MAX - digit) / 10) {
+            skip_word(port);
+            error("unable to read number: out of range");
+        }
+        n = n * 10 + digit;
+        port_advance(port, 1);
+        c = port_lookahead(port, 0);
+    }
+
+    if (c == '.' || c == 'e' || c == 'E') {
+        skip_word(port);
+        error("unable to read number: only integers are supported");
+    }
+    return make_number(negative ? -n : n);
+}
+
+
+static object *read_literal(object *port)
+{
+    static struct {
+        char const *text;
+        size_t len;
+    } const literals[] = {
+        { "true", 4 }, { "false", 5 }, { "null", 4 }
+    };
+
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        size_t len = literals[i].len;
+        if (port_lookahead(port, len - 1) != EOF &&
+                memcmp(port_position(port), literals[i].text, len) == 0) {
+            port_advance(port, len);
+            switch (i) {
+            case 0:  return get_boolean(1);
+            case 1:  return get_boolean(0);
+            default: return make_symbol("null");
+            }
+        }
+    }
+    skip_word(port);
+    error("json syntax error: unrecognized literal");
+}
+
+
+/* Reads an object key, and the colon after it, onto the value stack.
+ */
+static void read_key(struct json_reader *r, object *port)
+{
+    if (skip_space(port) != '"') {
+        skip_char(port);
+        error("json syntax error: expected a string key");
+    }
+    push_value(r, make_symbol(read_string(port)));
+    expect(port, ':');
+}
+
+
+/* Reads the next JSON value from port. Returns the end of file object if
+ * there is nothing but whitespace left.
+ */
+object *json_read(object *port)
+{
+    if (port_is_closed(port)) {
+        error("port is closed");
+    }
+    if (skip_space(port) == EOF) {
+        return get_end_of_file();
+    }
+
+    struct json_reader r = { NULL, 0, 0, NULL, 0, 0 };
+    for (;;) {
+        // Read a value, or open an array or object and go on to read the
+        // first thing in it.
+        object *value;
+        int c = skip_space(port);
+        if (c == '[' || c == '{') {
+            char close = c == '[' ? ']' : '}';
+            port_advance(port, 1);
+            push_frame(&r, close);
+            if (skip_space(port) != close) {
+                if (close == '}') {
+                    read_key(&r, port);
+                }
+                continue;
+            }
+            port_advance(port, 1);
+            value = pop_frame(&r);
+        } else if (c == '"') {
+            value = make_string(read_string(port));
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            value = read_number(port);
+        } else if (c == 't' || c == 'f' || c == 'n') {
+            value = read_literal(port);
+        } else if (c == EOF) {
+            error("end of file inside json data");
+        } else {
+            port_advance(port, 1);
+            error("json syntax error: unexpected '%c'", c);
+        }
+
+        // Add the value to the array or object it's in, and close any that
+        // end after it.
+        for (;;) {
+            if (r.depth == 0) {
+                return value;
+            }
+            push_value(&r, value);
+
+            char close = r.frames[r.depth - 1].close;
+            c = skip_space(port);
+            if (c == ',') {
+                port_advance(port, 1);
+                if (close == '}') {
+                    read_key(&r, port);
+                }
+                break;
+            } else if (c == close) {
+                port_advance(port, 1);
+                value = pop_frame(&r);
+            } else {
+                skip_char(port);
+                error("json syntax error: expected ',' or '%c'", close);
+            }
+        }
+    }
+}
+
+
+static void write_json_string(char const *s, object *port)
+{
+    write_port_bytes(port, "\"", 1);
+    for (;;) {
+        char const *run = s;
+        while ((unsigned char)*s >= 0x20 && *s != '"' && *s != '\\') {
+            s++;
+        }
+        write_port_bytes(port, run, (size_t)(s - run));
+
+        char escape[8];
+        switch (*s) {
+        case '\0': write_port_bytes(port, "\"", 1); return;
+        case '"':  write_port_bytes(port, "\\\"", 2); break;
+        case '\\': write_port_bytes(port, "\\\\", 2); break;
+        case '\n': write_port_bytes(port, "\\n", 2); break;
+        case '\r': write_port_bytes(port, "\\r", 2); break;
+        case '\t': write_port_bytes(port, "\\t", 2); break;
+        default:
+            snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*s);
+            write_port_bytes(port, escape, 6);
+        }
+        s++;
+    }
+}
+
+
+/* While writing, each open array or object has an entry on a stack, with
+ * the index of its next element or the rest of its association list.
+ */
+struct json_entry {
+    object *obj;
+    long index;
+};
+
+struct json_writer {
+    struct json_entry *entries;
+    size_t count, size;
+    object *port;
+};
+
+
+/* Writes exp if it's an atom. Otherwise, opens it and pushes an entry for
+ * its contents.
+ */
+static void write_value(struct json_writer *w, object *exp)
+{
+    char buf[32];
+    if (is_vector(exp) || is_pair(exp)) {
+        if (w->count == w->size) {
+            w->size = w->size == 0 ? JSON_STACK_SIZE : w->size * 2;
+            w->entries = GC_REALLOC(w->entries,
+                    w->size * sizeof(struct json_entry));
+            if (w->entries == NULL) {
+                error("unable to grow json stack:");
+            }
+        }
+        w->entries[w->count].obj = exp;
+        w->entries[w->count].index = 0;
+        w->count++;
+        write_port_bytes(w->port, is_vector(exp) ? "[" : "{", 1);
+    } else if (is_empty_list(exp)) {
+        write_port_bytes(w->port, "{}", 2);
+    } else if (is_string(exp)) {
+        write_json_string(exp->value.string, w->port);
+    } else if (is_number(exp)) {
+        int len = snprintf(buf, sizeof(buf), "%ld", exp->value.number);
+        write_port_bytes(w->port, buf, (size_t)len);
+    } else if (is_boolean(exp)) {
+        if (is_true(exp)) {
+            write_port_bytes(w->port, "true", 4);
+        } else {
+            write_port_bytes(w->port, "false", 5);
+        }
+    } else if (exp == lookup_symbol("null")) {
+        write_port_bytes(w->port, "null", 4);
+    } else if (is_symbol(exp)) {
+        write_json_string(exp->value.symbol, w->port);
+    } else {
+        error("unable to write object as json");
+    }
+}
+
+
+/* Writes exp to port as JSON, with no added whitespace.
+ */
+void json_write(object *exp, object *port)
+{
+    struct json_writer w = { NULL, 0, 0, port };
+    write_value(&w, exp);
+
+    while (w.count > 0) {
+        struct json_entry *e = &w.entries[w.count - 1];
+        object *obj = e->obj;
+
+        if (is_vector(obj)) {
+            if (e->index == obj->value.vector.length) {
+                w.count--;
+                write_port_bytes(port, "]", 1);
+                continue;
+            }
+            if (e->index > 0) {
+                write_port_bytes(port, ",", 1);
+            }
+            write_value(&w, obj->value.vector.items[e->index++]);
+            continue;
+        }
+
+        // An association list; the entry holds what's left of it.
+        if (is_empty_list(obj)) {
+            w.count--;
+            write_port_bytes(port, "}", 1);
+            continue;
+        }
+        object *binding = is_pair(obj) ? car(obj) : obj;
+        if (!is_pair(binding) ||
+                !(is_symbol(car(binding)) || is_string(car(binding)))) {
+            error("unable to write list as json: not an association list");
+        }
+        if (e->index > 0) {
+            write_port_bytes(port, ",", 1);
+        }
+        e->index = 1;
+        e->obj = cdr(obj);
+
+        object *key = car(binding);
+        write_json_string(is_symbol(key) ?
+                key->value.symbol : key->value.string, port);
+        write_port_bytes(port, ":", 1);
+        write_value(&w, cdr(binding));
+    }
+}
+
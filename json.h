@@ -0,0 +1,16 @@
+/* Reading and writing JSON.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include "object.h"
+
+object *json_read(object *port);
+void json_write(object *exp, object *port);
+
+#endif
+
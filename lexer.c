@@ -7,246 +7,389 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
+#include <limits.h>
 #include <ctype.h>
 #include "gc.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "error.h"
 #include "lexer.h"
+#include "object.h"
 #include "port.h"
+#include "table.h"
 
-/**** Lexical analysis ****/
-static void tokenize_line(void);
-static int is_delim(char c);
-static token *lex_token(char const *start, char const **end);
-static int lex_number(char const *start, char const **end, long *value);
-static int lex_boolean(char const *start, char const **end, int *value);
-static int lex_character(char const *start, char const **end, char *value);
-static int lex_string(char const *start, char const **end, char **value);
-static int is_initial(char c);
-static int is_subsequent(char c);
-static int lex_symbol(char const *start, char const **end, char **value);
-
-/**** Token allocation and queuing ****/
-static token *alloc_token(void);
-static void add_token_to_queue(token *t);
-static token *get_token_from_queue(void);
-static inline int queue_is_empty(void);
+/**** Character classes ****/
+#define CLASS_SPACE         0x01
+#define CLASS_DELIM         0x02
+#define CLASS_INITIAL       0x04
+#define CLASS_SUBSEQUENT    0x08
 
+static unsigned char char_class[UCHAR_MAX + 1];
 
-/**** Public interface ****/
-token *get_token(void)
-{
-    while (queue_is_empty()) {
-        tokenize_line();
-    }
+static inline int is_space(char c);
+static inline int is_delim(char c);
+static inline int is_initial(char c);
+static inline int is_subsequent(char c);
 
-    return get_token_from_queue();
-}
+/**** Scanning ****/
+static char const *skip_space(char const *pos, char const *end);
+static char const *find_string_special(char const *pos, char const *end);
+static size_t scan_string(object *port);
+static size_t scan_atom(object *port);
 
+/**** Conversion ****/
+static object *lex_string(char const *start, size_t len);
+static size_t lex_number(char const *start, size_t len, long *value);
+static object *lex_boolean(char const *start, size_t len);
+static object *lex_character(char const *start, size_t len);
+static object *lex_symbol(char const *start, size_t len);
 
-/**** Lexical analysis ****/
-void tokenize_line(void)
+
+/**** Public interface ****/
+
+/* Builds the character class table. Must be called before anything is read.
+ */
+void init_lexer(void)
 {
-    char *buffer;
-    long len = read_line(&buffer);
+    for (int c = 0; c <= UCHAR_MAX; c++) {
+        unsigned char class = 0;
 
-    if (len < 0) {
-        add_token_to_queue(alloc_token());
-        return;
-    }
+        if (isspace(c)) {
+            class |= CLASS_SPACE;
+        }
+        if (isspace(c) || c == '\0' || c == '(' || c == ')' || c == '"') {
+            class |= CLASS_DELIM;
+        }
+        if (isalpha(c) || c == '!' || c == '$' || c == '%' || c == '&' ||
+                c == '*' || c == '/' || c == ':' || c == '<' || c == '=' ||
+                c == '>' || c == '?' || c == '^' || c == '_' || c == '~') {
+            class |= CLASS_INITIAL | CLASS_SUBSEQUENT;
+        }
+        if (isdigit(c) || c == '+' || c == '-' || c == '.' || c == '@') {
+            class |= CLASS_SUBSEQUENT;
+        }
 
-    char const *pos = buffer;
-    char const *end = NULL;
-    token *t;
-    while (*pos != '\0') {
-        t = lex_token(pos, &end);
-        if (t == NULL) break;
-        add_token_to_queue(t);
-        pos = end;
+        char_class[c] = class;
     }
 }
 
 
-static int is_delim(char c)
+/* Skips whitespace and comments. Returns the first character after them,
+ * without consuming it, or EOF.
+ */
+int lex_next_char(object *port)
 {
-    return  isspace(c) || c == '\0' ||
-            c == '(' || c == ')' ||
-            c == '"';
+    struct port_buffer *b = port->value.port.buffer;
+    int in_comment = 0;
+
+    for (;;) {
+        char const *pos = b->data + b->pos;
+        char const *end = b->data + b->end;
+
+        if (in_comment) {
+            char const *newline = memchr(pos, '\n', (size_t)(end - pos));
+            in_comment = newline == NULL;
+            pos = in_comment ? end : newline;
+        }
+        if (!in_comment) {
+            pos = skip_space(pos, end);
+            in_comment = pos < end && *pos == ';';
+        }
+
+        b->pos = (size_t)(pos - b->data);
+        if (pos < end && !in_comment) {
+            return (unsigned char)*pos;
+        } else if (pos == end && fill_port_buffer(port) == 0) {
+            return EOF;
+        }
+    }
 }
 
 
-/* Scan buffer for a token. Returns the first token in the buffer, or NULL if
- * none are found. The second parameter is set to the address of the character
- * just after the first token.
+/* Consumes a datum label, #n= or #n#, at the read position of port and
+ * stores n in label. Returns the label's final character, or 0 if there is no
+ * label at the read position.
  */
-static token *lex_token(char const *buffer, char const **end)
+int lex_label(object *port, long *label)
 {
-    while (isspace(*buffer)) {
-        buffer++;
+    if (port_lookahead(port, 0) != '#' || !isdigit(port_lookahead(port, 1))) {
+        return 0;
     }
 
-    if (*buffer == '\0' || *buffer == ';') {
-        return NULL;
+    long n = 0;
+    size_t len = 1;
+    int c;
+    while (isdigit(c = port_lookahead(port, len))) {
+        if (n > (LONG_MAX - 9) / 10) {
+            port_advance(port, len);
+            error("datum label is too large");
+        }
+        n = n * 10 + (c - '0');
+        len++;
+    }
+    if (c != '=' && c != '#') {
+        port_advance(port, len);
+        error("malformed datum label");
     }
 
-    token *t = alloc_token();
-
-    if (*buffer == '(') {
-        t->type = TOK_LPAREN;
-        *end = buffer + 1;
-        return t;
-    } else if (*buffer == ')') {
-        t->type = TOK_RPAREN;
-        *end = buffer + 1;
-        return t;
-    } else if (*buffer == '.') {
-        t->type = TOK_DOT;
-        *end = buffer + 1;
-    } else if (*buffer == '\'') {
-        t->type = TOK_QUOTE;
-        *end = buffer + 1;
-        return t;
-    } else if (lex_number(buffer, end, &t->value.number)) {
-        t->type = TOK_NUMBER;
-    } else if (lex_boolean(buffer, end, &t->value.boolean)) {
-        t->type = TOK_BOOLEAN;
-    } else if (lex_character(buffer, end, &t->value.character)) {
-        t->type = TOK_CHARACTER;
-    } else if (lex_string(buffer, end, &t->value.string)) {
-        t->type = TOK_STRING;
-    } else if (lex_symbol(buffer, end, &t->value.symbol)) {
-        t->type = TOK_SYMBOL;
-    } else {
-        error("unable to create token from input");
+    port_advance(port, len + 1);
+    *label = n;
+    return c;
+}
+
+
+/* Converts the string, number, boolean, character or symbol at the read
+ * position of port straight into an object, and consumes it. Returns NULL
+ * for a lone dot, which only the reader can make sense of.
+ *
+ * Atoms may span buffer refills; they are scanned with port_lookahead, so
+ * they are contiguous in the port buffer by the time they are converted.
+ * They are consumed before they are converted, so that a malformed atom is
+ * skipped rather than read again by whoever catches the error.
+ */
+object *lex_atom(object *port)
+{
+    object *obj;
+
+    if (port_lookahead(port, 0) == '"') {
+        size_t len = scan_string(port);
+        char const *start = port_position(port);
+        port_advance(port, len);
+        obj = lex_string(start, len);
+
+        int c = port_lookahead(port, 0);
+        if (c != EOF && !is_delim((char)c)) {
+            port_advance(port, scan_atom(port));
+            error("trailing characters after token");
+        }
+        return obj;
     }
 
-    if (!is_delim(**end)) {
+    size_t len = scan_atom(port);
+    char const *start = port_position(port);
+    port_advance(port, len);
+    long number;
+    size_t num_len = lex_number(start, len, &number);
+
+    if (len == 1 && *start == '.') {
+        obj = NULL;
+    } else if (num_len == len) {
+        obj = make_number(number);
+    } else if (num_len > 0 || *start == '.') {
         error("trailing characters after token");
+    } else {
+        obj = lex_boolean(start, len);
+        if (obj == NULL) {
+            obj = lex_character(start, len);
+        }
+        if (obj == NULL) {
+            obj = lex_symbol(start, len);
+        }
+        if (obj == NULL) {
+            error("unable to create token from input");
+        }
     }
+    return obj;
+}
 
-    return t;
+
+/**** Character classes ****/
+static inline int is_space(char c)
+{
+    return char_class[(unsigned char)c] & CLASS_SPACE;
 }
 
 
-/* There is a lex_X function for each token type. They all return true if the
- * string given as the first parameter matches, and false otherwise. The
- * second parameter is used to return a pointer to the next character after
- * the token that was recognized. If there was no match, it will equal start.
- * Finally, if a match was found, its value is stored in the last parameter.
+static inline int is_delim(char c)
+{
+    return char_class[(unsigned char)c] & CLASS_DELIM;
+}
+
+
+static inline int is_initial(char c)
+{
+    return char_class[(unsigned char)c] & CLASS_INITIAL;
+}
+
+
+static inline int is_subsequent(char c)
+{
+    return char_class[(unsigned char)c] & CLASS_SUBSEQUENT;
+}
+
+
+/**** Scanning ****/
+
+/* Returns the first byte in [pos, end) that is not whitespace, or end. Checks
+ * 32 or 16 bytes at a time when AVX2 or SSE2 is available.
  */
-static int lex_number(char const *start, char const **end, long *value)
+static char const *skip_space(char const *pos, char const *end)
 {
-    if (!isdigit(*start) && *start != '-') {
-        *end = start;
-        return 0;
+#if defined(__AVX2__)
+    __m256i const space = _mm256_set1_epi8(' ');
+    __m256i const tab = _mm256_set1_epi8('\t');
+    __m256i const span = _mm256_set1_epi8('\r' - '\t');
+    while (end - pos >= 32) {
+        __m256i chunk = _mm256_loadu_si256((__m256i const *)pos);
+        // The other whitespace characters are '\t' through '\r'.
+        __m256i offset = _mm256_sub_epi8(chunk, tab);
+        __m256i is_ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, span),
+                offset);
+        __m256i is_blank = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+                is_ctrl);
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(is_blank);
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
+    }
+#elif defined(__SSE2__)
+    __m128i const space = _mm_set1_epi8(' ');
+    __m128i const tab = _mm_set1_epi8('\t');
+    __m128i const span = _mm_set1_epi8('\r' - '\t');
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i const *)pos);
+        // The other whitespace characters are '\t' through '\r'.
+        __m128i offset = _mm_sub_epi8(chunk, tab);
+        __m128i is_ctrl = _mm_cmpeq_epi8(_mm_min_epu8(offset, span), offset);
+        __m128i is_blank = _mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+                is_ctrl);
+        unsigned mask = (unsigned)_mm_movemask_epi8(is_blank) ^ 0xffffu;
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos < end && is_space(*pos)) {
+        pos++;
     }
+    return pos;
+}
 
-    errno = 0;
-    char *num_end;
-    long num = strtol(start, &num_end, 0);
 
-    if (num_end == start) {
-        return 0;
-    } else if (errno) {
-        error("unable to read number:");
+/* Returns the first double quote or backslash in [pos, end), or end. Checks
+ * 32 or 16 bytes at a time when AVX2 or SSE2 is available.
+ */
+static char const *find_string_special(char const *pos, char const *end)
+{
+#if defined(__AVX2__)
+    __m256i const quote = _mm256_set1_epi8('"');
+    __m256i const backslash = _mm256_set1_epi8('\\');
+    while (end - pos >= 32) {
+        __m256i chunk = _mm256_loadu_si256((__m256i const *)pos);
+        __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote),
+                _mm256_cmpeq_epi8(chunk, backslash));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(special);
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 32;
     }
-
-    *value = num;
-    *end = num_end;
-    return 1;
+#elif defined(__SSE2__)
+    __m128i const quote = _mm_set1_epi8('"');
+    __m128i const backslash = _mm_set1_epi8('\\');
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i const *)pos);
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                _mm_cmpeq_epi8(chunk, backslash));
+        unsigned mask = (unsigned)_mm_movemask_epi8(special);
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos < end && *pos != '"' && *pos != '\\') {
+        pos++;
+    }
+    return pos;
 }
 
 
-static int lex_boolean(char const *start, char const **end, int *value)
+/* Returns the length of the string literal at the read position of port,
+ * including both quotes. The whole literal is in the port buffer afterwards.
+ */
+static size_t scan_string(object *port)
 {
-    if (*start != '#') {
-        *end = start;
-        return 0;
-    } else {
-        char next = *(start + 1);
-        if (next == 't' || next == 'T') {
-            *value = 1;
-        } else if (next == 'f' || next == 'F') {
-            *value = 0;
+    struct port_buffer *b = port->value.port.buffer;
+    size_t len = 1;
+
+    for (;;) {
+        if (port_lookahead(port, len) == EOF) {
+            port_advance(port, len);
+            error("unterminated string constant.");
+        }
+
+        char const *start = b->data + b->pos;
+        char const *end = b->data + b->end;
+        char const *pos = find_string_special(start + len, end);
+        if (pos == end) {
+            len = (size_t)(end - start);
+        } else if (*pos == '"') {
+            return (size_t)(pos - start) + 1;
         } else {
-            *end = start;
-            return 0;
+            // Skip the backslash and the character it escapes.
+            len = (size_t)(pos - start) + 2;
         }
     }
-
-    *end = start + 2;
-    return 1;
 }
 
 
-static int lex_character(char const *start, char const **end, char *value)
+/* Returns the length of the atom at the read position of port. The whole atom
+ * is in the port buffer afterwards.
+ */
+static size_t scan_atom(object *port)
 {
-    if (*start != '#' && *(start + 1) != '\\') {
-        *end = start;
-        return 0;
-    }
+    struct port_buffer *b = port->value.port.buffer;
+    size_t len = 0;
 
-    char const *pos = start + 2;
-    if (isspace(*pos)) {
-        *end = start;
-        return 0;
+    // The character after #\ is part of the atom even if it is a delimiter.
+    if (port_lookahead(port, 0) == '#' && port_lookahead(port, 1) == '\\' &&
+            port_lookahead(port, 2) != EOF) {
+        len = 3;
     }
 
-    if (*pos == 's' && !is_delim(*(pos + 1))) {
-        if (strncmp(pos , "space", 4) == 0) {
-            *value = ' ';
-            *end = pos + 5;
-            return 1;
-        } else {
-            *end = start;
-            return 0;
+    while (port_lookahead(port, len) != EOF) {
+        char const *start = b->data + b->pos;
+        char const *pos = start + len;
+        char const *end = b->data + b->end;
+        while (pos < end && !is_delim(*pos)) {
+            pos++;
         }
-    } else if (*pos == 'n' && !is_delim(*(pos + 1))) {
-        if (strncmp((pos), "newline", 7) == 0) {
-            *value = '\n';
-            *end = pos + 7;
-            return 1;
-        } else {
-            *end = start;
-            return 0;
+        len = (size_t)(pos - start);
+        if (pos < end) {
+            break;
         }
     }
-
-    *value = *pos;
-    *end = start + 3;
-    return 1;
+    return len;
 }
 
 
-static int lex_string(char const *start, char const **end, char **value)
+/**** Conversion ****/
+
+/* There is a lex_X function for each kind of atom. Each takes the atom's
+ * text, which is not null-terminated, and its length. They return the
+ * resulting object, or NULL if the text is not an atom of that kind.
+ */
+static object *lex_string(char const *start, size_t len)
 {
-    if (*start != '"') {
-        *end = start;
-        return 0;
+    // The literal minus its quotes is an upper bound on the string's size.
+    char *buffer = GC_MALLOC_ATOMIC(len - 1);
+    if (buffer == NULL) {
+        error("unable to allocate string buffer:");
     }
 
-    size_t size = 64;
-    char *buffer = GC_MALLOC(size);
-
     char const *in_pos = start + 1;
+    char const *end = start + len - 1;
     char *out_pos = buffer;
-    size_t bytes = 0;
-
-    while (*in_pos != '"') {
-        if (*in_pos == '\0') {
-            error("unterminated string constant.");
-        }
-
-        if (bytes > size - 1) {
-            size += 64;
-            buffer = GC_REALLOC(buffer, size);
-            if (buffer == NULL) {
-                error("unable to increase string buffer size:");
-            }
-            out_pos = buffer + bytes;
-        }
 
+    while (in_pos < end) {
         if (*in_pos == '\\') {
             in_pos++;
             if (*in_pos == 'n') {
@@ -256,7 +399,7 @@ static int lex_string(char const *start, char const **end, char **value)
             } else if (*in_pos == '\\') {
                 *out_pos = '\\';
             } else {
-                error("unrecognized escape sequence: \\%c", *out_pos);
+                error("unrecognized escape sequence: \\%c", *in_pos);
             }
             out_pos++;
             in_pos++;
@@ -264,129 +407,143 @@ static int lex_string(char const *start, char const **end, char **value)
         }
 
         *out_pos++ = *in_pos++;
-        bytes++;
     }
 
     *out_pos = '\0';
-    *value = buffer;
-    *end = in_pos + 1;
-    return 1;
+    return make_string(buffer);
 }
 
 
-static int is_initial(char c)
-{
-    return isalpha(c) || c == '!' || c == '$' || c == '%' || c == '&' ||
-        c == '*' || c == '/' || c == ':' || c == '<' || c == '>' ||
-        c == '?' || c == '^' || c == '_' || c == '~';
-}
-
-
-static int is_subsequent(char c)
+/* Numbers follow strtol's base 0 rules: a 0x prefix means hexadecimal, and a
+ * leading 0 means octal. Returns the number of characters that make up the
+ * number, which is 0 if there is none and less than len if it is followed by
+ * trailing characters.
+ */
+static size_t lex_number(char const *start, size_t len, long *value)
 {
-    return is_initial(c) || isdigit(c) || c == '+' ||
-        c == '-' || c == '.' || c == '@';
-}
+    char const *pos = start;
+    char const *end = start + len;
+    int negative = 0;
 
-
-static int lex_symbol(char const *start, char const **end, char **value)
-{
-    if (*start == '=' && is_delim(*(start + 1))) {
-        *value = "=";
-        *end = start + 1;
-        return 1;
+    if (pos < end && *pos == '-') {
+        negative = 1;
+        pos++;
     }
-
-    if (!(is_initial(*start) ||
-                ((*start == '+' ||  *start == '-') && is_delim(*(start+1))))) {
-        *end = start;
+    if (pos == end || !isdigit((unsigned char)*pos)) {
         return 0;
     }
 
-    size_t size = 64;
-    char *buffer = GC_MALLOC(size);
+    unsigned long base = 10;
+    if (*pos == '0') {
+        if (end - pos > 2 && (pos[1] == 'x' || pos[1] == 'X') &&
+                isxdigit((unsigned char)pos[2])) {
+            base = 16;
+            pos += 2;
+        } else {
+            base = 8;
+        }
+    }
 
-    char const *in_pos = start;
-    char *out_pos = buffer;
-    size_t bytes = 0;
-
-    while (is_subsequent(*in_pos)) {
-        if (bytes > size - 1) {
-            size += 64;
-            buffer = GC_REALLOC(buffer, size);
-            if (buffer == NULL) {
-                error("unable to increase symbol buffer size:");
-            }
-            out_pos = buffer + bytes;
+    unsigned long limit = negative ?
+        (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX;
+    unsigned long num = 0;
+    while (pos < end) {
+        unsigned long digit;
+        if (isdigit((unsigned char)*pos)) {
+            digit = (unsigned long)(*pos - '0');
+        } else if (base == 16 && isxdigit((unsigned char)*pos)) {
+            digit = (unsigned long)(tolower((unsigned char)*pos) - 'a' + 10);
+        } else {
+            break;
+        }
+        if (digit >= base) {
+            break;
+        }
+        if (num > (limit - digit) / base) {
+            error("unable to read number: out of range");
         }
-        *out_pos++ = (char)tolower(*in_pos++);
-        bytes++;
+        num = num * base + digit;
+        pos++;
     }
 
-    *out_pos = '\0';
-    *value = buffer;
-    *end = in_pos;
-    return 1;
+    if (negative) {
+        *value = num == (unsigned long)LONG_MAX + 1 ?
+            LONG_MIN : -(long)num;
+    } else {
+        *value = (long)num;
+    }
+    return (size_t)(pos - start);
 }
 
 
-/**** Token allocation and queuing ****/
-static token *queue_front = NULL;
-static token *queue_back = NULL;
-
-
-static token *alloc_token(void)
+static object *lex_boolean(char const *start, size_t len)
 {
-    token *t = GC_MALLOC(sizeof(token));
-    if (t == NULL) {
-        error("unable to allocate a token:");
+    if (len != 2 || start[0] != '#') {
+        return NULL;
     }
 
-    t->type = TOK_DONE;
-    t->next = NULL;
-
-    return t;
+    if (start[1] == 't' || start[1] == 'T') {
+        return get_boolean(1);
+    } else if (start[1] == 'f' || start[1] == 'F') {
+        return get_boolean(0);
+    }
+    return NULL;
 }
 
 
-static void add_token_to_queue(token *t)
+static object *lex_character(char const *start, size_t len)
 {
-    if (queue_is_empty()) {
-        queue_front = queue_back = t;
-    } else {
-        queue_back->next = t;
-        queue_back = t;
+    if (len < 3 || start[0] != '#' || start[1] != '\\' ||
+            is_space(start[2])) {
+        return NULL;
     }
 
-    t->next = NULL;
+    if (len == 3) {
+        return make_character(start[2]);
+    } else if (len == 7 && strncmp(start + 2, "space", 5) == 0) {
+        return make_character(' ');
+    } else if (len == 9 && strncmp(start + 2, "newline", 7) == 0) {
+        return make_character('\n');
+    }
+    return NULL;
 }
 
 
-static token *get_token_from_queue(void)
+/* Symbols are folded to lower case. Symbols that are already interned are
+ * looked up from a scratch copy, so re-reading them allocates nothing.
+ */
+static object *lex_symbol(char const *start, size_t len)
 {
-    while (queue_is_empty()) {
-        //lex_input();
+    int peculiar = len == 1 && (*start == '+' || *start == '-');
+    if (!peculiar && !is_initial(*start)) {
+        return NULL;
     }
 
-    token *t = queue_front;
-    queue_front = t->next;
-    t->next = NULL;
-    return t;
-}
-
+    char scratch[128];
+    char *name = len < sizeof(scratch) ? scratch : GC_MALLOC_ATOMIC(len + 1);
+    if (name == NULL) {
+        error("unable to allocate symbol buffer:");
+    }
 
-void push_back_token(token *t)
-{
-    if (t == NULL) {
-        error("null token");
+    for (size_t i = 0; i < len; i++) {
+        if (i > 0 && !is_subsequent(start[i])) {
+            error("trailing characters after token");
+        }
+        name[i] = (char)tolower(start[i]);
     }
+    name[len] = '\0';
 
-    t->next = queue_front;
-    queue_front = t;
-}
+    object *sym = lookup_symbol(name);
+    if (sym != NULL) {
+        return sym;
+    }
 
-static inline int queue_is_empty(void)
-{
-    return queue_front == NULL;
+    if (name == scratch) {
+        name = GC_MALLOC_ATOMIC(len + 1);
+        if (name == NULL) {
+            error("unable to allocate symbol buffer:");
+        }
+        memcpy(name, scratch, len + 1);
+    }
+    return make_symbol(name);
 }
-
@@ -24,6 +24,7 @@ extern object *car(object *pair);
 extern void set_car(object *pair, object *obj);
 extern object *cdr(object *pair);
 extern void set_cdr(object *pair, object *obj);
+extern int is_vector(object *obj);
 extern int is_primitive_proc(object *obj);
 extern int is_compound_proc(object *obj);
 extern int is_procedure(object *obj);
@@ -32,6 +33,9 @@ extern int is_port(object *obj);
 extern int is_input_port(object *obj);
 extern int is_output_port(object *obj);
 
+extern int is_autoload(object *obj);
+extern int is_error_object(object *obj);
+
 static object *alloc_object(void);
 
 static object end_of_file_object = { .type = END_OF_FILE };
@@ -133,6 +137,24 @@ int is_list(object *obj)
 }
 
 
+object *make_vector(long length, object *fill)
+{
+    object *v = alloc_object();
+    v->type = VECTOR;
+    v->value.vector.length = length;
+    v->value.vector.items = GC_MALLOC((size_t)(length > 0 ? length : 1) *
+            sizeof(object *));
+    if (v->value.vector.items == NULL) {
+        error("unable to allocate a vector:");
+    }
+    for (long i = 0; i < length; i++) {
+        v->value.vector.items[i] = fill;
+    }
+
+    return v;
+}
+
+
 object *make_symbol(char const *name)
 {
     object *sym = lookup_symbol(name);
@@ -191,3 +213,76 @@ object *make_output_port(char const *file)
     return op;
 }
 
+
+object *make_fd_port(int fd, int mode)
+{
+    object *p = alloc_object();
+    p->type = PORT;
+    p->value.port.mode = mode;
+    p->value.port.state = 0;
+    open_fd_port(p, fd);
+    return p;
+}
+
+
+object *make_pipe_port(char const *command, int mode)
+{
+    object *p = alloc_object();
+    p->type = PORT;
+    p->value.port.mode = mode;
+    p->value.port.state = 0;
+    open_pipe_port(p, command);
+    return p;
+}
+
+
+object *make_process_port(char const *const *argv, long *status)
+{
+    object *ip = alloc_object();
+    ip->type = PORT;
+    ip->value.port.mode = 0;
+    ip->value.port.state = 0;
+    open_process_port(ip, argv, status);
+    return ip;
+}
+
+
+object *make_input_string_port(char const *s)
+{
+    object *ip = alloc_object();
+    ip->type = PORT;
+    ip->value.port.mode = 0;
+    ip->value.port.state = 0;
+    open_string_port(ip, s);
+    return ip;
+}
+
+
+object *make_output_string_port(void)
+{
+    object *op = alloc_object();
+    op->type = PORT;
+    op->value.port.mode = 1;
+    op->value.port.state = 0;
+    open_string_port(op, NULL);
+    return op;
+}
+
+
+object *make_autoload(char const *source)
+{
+    object *a = alloc_object();
+    a->type = AUTOLOAD;
+    a->value.autoload = source;
+    return a;
+}
+
+
+object *make_error_object(object *message, object *irritants)
+{
+    object *e = alloc_object();
+    e->type = ERROR_OBJECT;
+    e->value.error_object.message = message;
+    e->value.error_object.irritants = irritants;
+    return e;
+}
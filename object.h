@@ -11,6 +11,8 @@
 
 #include "error.h"
 
+struct port_buffer;
+
 typedef enum {
     NUMBER,
     BOOLEAN,
@@ -19,10 +21,13 @@ typedef enum {
     SYMBOL,
     EMPTY_LIST,
     PAIR,
+    VECTOR,
     PRIMITIVE_PROC,
     COMPOUND_PROC,
     END_OF_FILE,
-    PORT
+    PORT,
+    AUTOLOAD,
+    ERROR_OBJECT
 } object_type;
 
 
@@ -37,6 +42,10 @@ typedef struct object {
             struct object *car;
             struct object *cdr;
         } pair;
+        struct {
+            struct object **items;
+            long length;
+        } vector;
         struct object *(*primitive_proc)(struct object *arguments);
         struct {
             struct object *parameters;
@@ -46,8 +55,13 @@ typedef struct object {
         struct {
             int mode;   // 0 for input, 1 for output
             int state;  // -1 for eof, 0 for closed, 1 for open
-            FILE *file;
+            struct port_buffer *buffer;
         } port;
+        char const *autoload;   // source text of the definition to load
+        struct {
+            struct object *message;
+            struct object *irritants;
+        } error_object;
     } value;
     object_type type;
 } object;
@@ -107,6 +121,9 @@ static inline void set_cdr(object *pair, object *obj)
 }
 
 
+object *make_vector(long length, object *fill);
+static inline int is_vector(object *obj) { return obj->type == VECTOR; }
+
 object *make_primitive_proc(object *(*fn)(object *args));
 static inline int is_primitive_proc(object *obj)
 {
@@ -124,6 +141,11 @@ static inline int is_procedure(object *obj)
 
 object *make_input_port(char const *file);
 object *make_output_port(char const *file);
+object *make_fd_port(int fd, int mode);
+object *make_pipe_port(char const *command, int mode);
+object *make_process_port(char const *const *argv, long *status);
+object *make_input_string_port(char const *s);
+object *make_output_string_port(void);
 static inline int is_port(object *obj) { return obj->type == PORT; }
 
 static inline int is_input_port(object *obj)
@@ -136,5 +158,14 @@ static inline int is_output_port(object *obj)
     return is_port(obj) && obj->value.port.mode == 1;
 }
 
+object *make_autoload(char const *source);
+static inline int is_autoload(object *obj) { return obj->type == AUTOLOAD; }
+
+object *make_error_object(object *message, object *irritants);
+static inline int is_error_object(object *obj)
+{
+    return obj->type == ERROR_OBJECT;
+}
+
 #endif
 
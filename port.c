@@ -4,8 +4,23 @@
  * See the LICENSE file for terms of use.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
 #include "gc.h"
 
 #include "error.h"
@@ -14,6 +29,9 @@
 extern int port_is_open(object *p);
 extern int port_is_closed(object *p);
 extern int port_is_eof(object *p);
+extern int port_lookahead(object *p, size_t offset);
+extern char const *port_position(object *p);
+extern void port_advance(object *p, size_t count);
 
 static object standard_input_port;
 static object standard_output_port;
@@ -23,23 +41,356 @@ static object *input_port = &standard_input_port;
 static object *output_port = &standard_output_port;
 static object *error_port = &standard_error_port;
 
+// Output ports opened on files, so they can be flushed at exit.
+static object *open_output_ports = NULL;
+
+
+static void flush_all_ports(void);
+
+/**** Port implementations ****/
+static long fd_fill(object *p);
+static void fd_flush(object *p);
+static void fd_close(object *p);
+static void mapped_close(object *p);
+static void pipe_close(object *p);
+static long gzip_fill(object *p);
+static void gzip_flush(object *p);
+static void gzip_close(object *p);
+static long read_ahead_fill(object *p);
+static void read_ahead_close(object *p);
+
+static struct port_ops const fd_port_ops = { fd_fill, fd_flush, fd_close };
+static struct port_ops const mapped_port_ops = { NULL, NULL, mapped_close };
+static struct port_ops const pipe_port_ops = { fd_fill, fd_flush, pipe_close };
+static struct port_ops const gzip_port_ops = {
+    gzip_fill, gzip_flush, gzip_close
+};
+static struct port_ops const read_ahead_port_ops = {
+    read_ahead_fill, NULL, read_ahead_close
+};
+static struct port_ops const string_port_ops = { NULL, NULL, NULL };
+
+// Whether stdin and input pipes are read ahead by a background thread.
+static int read_ahead = 0;
+
+#define STRING_PORT_SIZE 256
+
+
+static struct port_buffer *make_port_buffer(struct port_ops const *ops,
+        int fd, size_t size)
+{
+    struct port_buffer *b = GC_MALLOC(sizeof(struct port_buffer));
+    if (b == NULL) {
+        error("unable to allocate port buffer:");
+    }
+
+    b->data = GC_MALLOC_ATOMIC(size);
+    if (b->data == NULL) {
+        error("unable to allocate port buffer:");
+    }
+
+    b->ops = ops;
+    b->fd = fd;
+    b->pos = 0;
+    b->end = 0;
+    b->size = size;
+    b->line_buffered = 0;
+    b->pid = 0;
+    b->state = NULL;
+    return b;
+}
+
+
+static void grow_port_buffer(struct port_buffer *b, size_t needed)
+{
+    size_t size = b->size * 2;
+    if (size < needed) {
+        size = needed;
+    }
+
+    b->data = GC_REALLOC(b->data, size);
+    if (b->data == NULL) {
+        error("unable to grow port buffer:");
+    }
+    b->size = size;
+}
+
+
+/* Maps a regular file into memory as a port buffer, so the reader parses the
+ * file in place without any read(2) calls or copies. Returns NULL if fd can't
+ * be mapped, in which case it should be read normally.
+ */
+static struct port_buffer *map_port_buffer(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    (void)posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+
+    struct port_buffer *b = GC_MALLOC(sizeof(struct port_buffer));
+    if (b == NULL) {
+        error("unable to allocate port buffer:");
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    b->ops = &mapped_port_ops;
+    b->fd = -1;
+    b->data = data;
+    b->pos = 0;
+    b->end = size;
+    b->size = size;
+    b->line_buffered = 0;
+    b->pid = 0;
+    b->state = NULL;
+    return b;
+}
+
+
+static long fd_fill(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    ssize_t bytes;
+    do {
+        bytes = read(b->fd, b->data + b->end, b->size - b->end);
+    } while (bytes < 0 && errno == EINTR);
+
+    if (bytes < 0) {
+        error("error reading from port:");
+    }
+    return (long)bytes;
+}
+
+
+static void write_all(int fd, char const *s, size_t len)
+{
+    while (len > 0) {
+        ssize_t bytes = write(fd, s, len);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error("error writing to port:");
+        }
+        s += bytes;
+        len -= (size_t)bytes;
+    }
+}
+
+
+static void fd_flush(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    size_t len = b->end;
+
+    // Empty the buffer first, so a write error can't flush it again at exit.
+    b->end = 0;
+    write_all(b->fd, b->data, len);
+}
+
+
+static void fd_close(object *p)
+{
+    close(p->value.port.buffer->fd);
+}
+
+
+static void mapped_close(object *p)
+{
+    munmap(p->value.port.buffer->data, p->value.port.buffer->size);
+}
+
+
+/* A compressed port's buffer holds uncompressed data. Compressed bytes pass
+ * through a second buffer on their way to or from the file.
+ */
+struct gzip_state {
+    z_stream stream;
+    unsigned char *data;
+    int finished;   // the last member of the input was decompressed in full
+    long members;   // members decompressed in full so far
+};
+
+
+static struct port_buffer *make_gzip_buffer(int fd, int mode)
+{
+    struct port_buffer *b = make_port_buffer(&gzip_port_ops, fd,
+            PORT_BUFFER_SIZE);
+    struct gzip_state *g = GC_MALLOC(sizeof(struct gzip_state));
+    if (g == NULL) {
+        error("unable to allocate port buffer:");
+    }
+    g->data = GC_MALLOC_ATOMIC(PORT_BUFFER_SIZE);
+    if (g->data == NULL) {
+        error("unable to allocate port buffer:");
+    }
+
+    // A window size of 15 + 16 writes a gzip header; 15 + 32 reads either a
+    // gzip or a zlib header.
+    int ret = mode == 1 ?
+        deflateInit2(&g->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                8, Z_DEFAULT_STRATEGY) :
+        inflateInit2(&g->stream, 15 + 32);
+    if (ret != Z_OK) {
+        error("unable to initialize zlib");
+    }
+    b->state = g;
+    return b;
+}
+
+
+/* Inflates into the buffer after end, reading more of the file as needed.
+ * Consecutive gzip members are read as one stream, as gzip does.
+ */
+static long gzip_fill(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    struct gzip_state *g = b->state;
+    z_stream *z = &g->stream;
+
+    size_t room = b->size - b->end;
+    z->next_out = (Bytef *)(b->data + b->end);
+    z->avail_out = room > UINT_MAX ? UINT_MAX : (uInt)room;
+    uInt avail = z->avail_out;
+
+    while (z->avail_out == avail) {
+        if (z->avail_in == 0) {
+            ssize_t bytes;
+            do {
+                bytes = read(b->fd, g->data, PORT_BUFFER_SIZE);
+            } while (bytes < 0 && errno == EINTR);
+
+            if (bytes < 0) {
+                error("error reading from port:");
+            } else if (bytes == 0) {
+                // An empty file, or one that ends before the first member
+                // has produced anything, is just an empty stream.
+                int empty = g->members == 0 && z->total_out == 0;
+                if (!g->finished && !empty) {
+                    error("compressed input is truncated");
+                }
+                break;
+            }
+            z->next_in = g->data;
+            z->avail_in = (uInt)bytes;
+        }
+
+        g->finished = 0;
+        int ret = inflate(z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            g->finished = 1;
+            g->members++;
+            inflateReset(z);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            error("error decompressing input: %s",
+                    z->msg != NULL ? z->msg : "corrupt data");
+        }
+    }
+    return (long)(avail - z->avail_out);
+}
+
+
+/* Runs deflate on the pending input with the given flush mode, and writes
+ * out everything it produces.
+ */
+static void deflate_all(struct port_buffer *b, int flush)
+{
+    struct gzip_state *g = b->state;
+    z_stream *z = &g->stream;
+    do {
+        z->next_out = g->data;
+        z->avail_out = PORT_BUFFER_SIZE;
+        if (deflate(z, flush) == Z_STREAM_ERROR) {
+            error("error compressing output");
+        }
+        write_all(b->fd, (char const *)g->data,
+                PORT_BUFFER_SIZE - z->avail_out);
+    } while (z->avail_out == 0);
+}
+
+
+static void gzip_flush(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    z_stream *z = &((struct gzip_state *)b->state)->stream;
+
+    z->next_in = (Bytef *)b->data;
+    z->avail_in = (uInt)b->end;
+    b->end = 0;
+    deflate_all(b, Z_NO_FLUSH);
+}
+
+
+static void gzip_close(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    z_stream *z = &((struct gzip_state *)b->state)->stream;
+
+    if (p->value.port.mode == 1) {
+        z->avail_in = 0;
+        deflate_all(b, Z_FINISH);
+        deflateEnd(z);
+    } else {
+        inflateEnd(z);
+    }
+    close(b->fd);
+}
+
+
+/* Waits for child process pid to finish, and returns its exit status. A
+ * child killed by a signal gets 128 plus the signal number, as in the shell.
+ */
+static long wait_for_child(long pid)
+{
+    int status;
+    while (waitpid((pid_t)pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            error("unable to wait for child process:");
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+
+static void pipe_close(object *p)
+{
+    close(p->value.port.buffer->fd);
+    wait_for_child(p->value.port.buffer->pid);
+}
+
 
 void init_standard_ports(void)
 {
     standard_input_port.type = PORT;
     standard_input_port.value.port.mode = 0;
     standard_input_port.value.port.state = 1;
-    standard_input_port.value.port.file = stdin;
+    standard_input_port.value.port.buffer =
+        make_port_buffer(&fd_port_ops, STDIN_FILENO, PORT_BUFFER_SIZE);
 
     standard_output_port.type = PORT;
     standard_output_port.value.port.mode = 1;
     standard_output_port.value.port.state = 1;
-    standard_output_port.value.port.file = stdout;
+    standard_output_port.value.port.buffer =
+        make_port_buffer(&fd_port_ops, STDOUT_FILENO, PORT_BUFFER_SIZE);
+    standard_output_port.value.port.buffer->line_buffered =
+        isatty(STDOUT_FILENO);
 
     standard_error_port.type = PORT;
     standard_error_port.value.port.mode = 1;
     standard_error_port.value.port.state = 1;
-    standard_error_port.value.port.file = stderr;
+    standard_error_port.value.port.buffer =
+        make_port_buffer(&fd_port_ops, STDERR_FILENO, PORT_BUFFER_SIZE);
+    standard_error_port.value.port.buffer->line_buffered = 1;
+
+    open_output_ports = get_empty_list();
+    atexit(flush_all_ports);
 }
 
 
@@ -116,6 +467,27 @@ static int is_standard_port(object *p)
 }
 
 
+/* Opens p on a descriptor that is already open, such as a socket. The
+ * descriptor is closed along with the port.
+ */
+void open_fd_port(object *p, int fd)
+{
+    p->value.port.buffer = make_port_buffer(&fd_port_ops, fd,
+            PORT_BUFFER_SIZE);
+    if (p->value.port.mode == 1) {
+        open_output_ports = cons(p, open_output_ports);
+    }
+    p->value.port.state = 1;
+}
+
+
+static int is_compressed_file(char const *file)
+{
+    size_t len = strlen(file);
+    return len > 3 && strcmp(file + len - 3, ".gz") == 0;
+}
+
+
 void open_port(object *p, char const *file)
 {
     if (is_standard_port(p)) {
@@ -123,22 +495,49 @@ void open_port(object *p, char const *file)
         return;
     }
 
-    FILE *fp;
     if (p->value.port.mode == 1) {
-        fp = fopen(file, "w");
+        int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            error("unable to open %s:", file);
+        }
+        p->value.port.buffer = is_compressed_file(file) ?
+            make_gzip_buffer(fd, 1) :
+            make_port_buffer(&fd_port_ops, fd, PORT_BUFFER_SIZE);
+        open_output_ports = cons(p, open_output_ports);
     } else {
-        fp = fopen(file, "r");
-    }
-
-    if (fp == NULL) {
-        error("unable to open %s:", file);
+        int fd = open(file, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error("unable to open %s:", file);
+        }
+        p->value.port.buffer = is_compressed_file(file) ?
+            make_gzip_buffer(fd, 0) : map_port_buffer(fd);
+        if (p->value.port.buffer == NULL) {
+            p->value.port.buffer =
+                make_port_buffer(&fd_port_ops, fd, PORT_BUFFER_SIZE);
+        }
     }
 
-    p->value.port.file = fp;
     p->value.port.state = 1;
 }
 
 
+static void forget_output_port(object *p)
+{
+    object *prev = NULL;
+    for (object *l = open_output_ports; !is_empty_list(l); l = cdr(l)) {
+        if (car(l) == p) {
+            if (prev == NULL) {
+                open_output_ports = cdr(l);
+            } else {
+                set_cdr(prev, cdr(l));
+            }
+            return;
+        }
+        prev = l;
+    }
+}
+
+
 void close_port(object *p)
 {
     if (is_standard_port(p)) {
@@ -149,34 +548,428 @@ void close_port(object *p)
         return;
     }
 
-    fclose(p->value.port.file);
+    struct port_buffer *b = p->value.port.buffer;
+    if (p->value.port.mode == 1) {
+        flush_port(p);
+        forget_output_port(p);
+    }
+    if (b->ops->close != NULL) {
+        b->ops->close(p);
+    }
+    if (p->value.port.mode == 0) {
+        b->pos = b->end = 0;
+    }
     p->value.port.state = 0;
 }
 
 
-int read_char(void)
+extern char **environ;
+
+
+/* Starts the program argv[0], found through PATH, with the arguments in
+ * argv. One end of a new pipe becomes the child's child_fd, which is either
+ * its standard input or output; the other end is returned. Sets *pid to the
+ * child's process id.
+ */
+static int spawn_with_pipe(char const *const *argv, int child_fd, long *pid)
 {
-    if (port_is_closed(input_port)) {
-        error("port is closed");
+    // posix_spawnp wants writable strings.
+    size_t count = 0;
+    while (argv[count] != NULL) {
+        count++;
+    }
+    char **args = GC_MALLOC((count + 1) * sizeof(char *));
+    if (args == NULL) {
+        error("unable to allocate argument vector:");
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(argv[i]);
+        args[i] = GC_MALLOC_ATOMIC(len + 1);
+        if (args[i] == NULL) {
+            error("unable to allocate argument vector:");
+        }
+        memcpy(args[i], argv[i], len + 1);
     }
 
-    int c = fgetc(input_port->value.port.file);
-    if (c == EOF) {
-        if (ferror(input_port->value.port.file)) {
-            error("error reading from port:");
-        } else {
-            input_port->value.port.state = -1;
+    int fds[2];
+    if (pipe(fds) < 0) {
+        error("unable to create pipe:");
+    }
+    int parent_end = child_fd == STDOUT_FILENO ? fds[0] : fds[1];
+    int child_end = child_fd == STDOUT_FILENO ? fds[1] : fds[0];
+    fcntl(parent_end, F_SETFD, FD_CLOEXEC);
+    fcntl(child_end, F_SETFD, FD_CLOEXEC);
+
+    // Anything already written to the standard ports comes before the
+    // child's output.
+    flush_port(&standard_output_port);
+    flush_port(&standard_error_port);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, child_end, child_fd);
+    pid_t child;
+    int err = posix_spawnp(&child, args[0], &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(child_end);
+
+    if (err != 0) {
+        close(parent_end);
+        errno = err;
+        error("unable to run %s:", argv[0]);
+    }
+    *pid = child;
+    return parent_end;
+}
+
+
+/* Opens a pipe port to or from a shell running command. An input port reads
+ * the command's standard output, and an output port writes to its standard
+ * input. Closing the port waits for the command to finish.
+ */
+void open_pipe_port(object *p, char const *command)
+{
+    char const *argv[] = { "/bin/sh", "-c", command, NULL };
+    long pid;
+    int fd = spawn_with_pipe(argv, p->value.port.mode == 1 ?
+            STDIN_FILENO : STDOUT_FILENO, &pid);
+
+    p->value.port.buffer = make_port_buffer(&pipe_port_ops, fd,
+            PORT_BUFFER_SIZE);
+    p->value.port.buffer->pid = pid;
+    if (p->value.port.mode == 1) {
+        open_output_ports = cons(p, open_output_ports);
+    } else if (read_ahead) {
+        start_read_ahead(p);
+    }
+    p->value.port.state = 1;
+}
+
+
+/* Runs the program argv[0] with the arguments in argv to completion, and
+ * opens input port p on everything it wrote to its standard output. Sets
+ * *status to its exit status.
+ */
+void open_process_port(object *p, char const *const *argv, long *status)
+{
+    long pid;
+    int fd = spawn_with_pipe(argv, STDOUT_FILENO, &pid);
+
+    // The output is read straight into the buffer of an input string port.
+    struct port_buffer *b = make_port_buffer(&string_port_ops, -1,
+            PORT_BUFFER_SIZE);
+    for (;;) {
+        if (b->end == b->size) {
+            grow_port_buffer(b, b->size + 1);
+        }
+        ssize_t bytes = read(fd, b->data + b->end, b->size - b->end);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        } else if (bytes < 0) {
+            close(fd);
+            error("error reading from child process:");
+        } else if (bytes == 0) {
+            break;
         }
+        b->end += (size_t)bytes;
+    }
+    close(fd);
+
+    *status = wait_for_child(pid);
+    p->value.port.buffer = b;
+    p->value.port.state = 1;
+}
+
+
+/* A read-ahead port has a thread that reads its file into one of two
+ * chunks, while the interpreter copies the other one into the port buffer.
+ * Input arrives in the buffer as it would otherwise, but reading overlaps
+ * with evaluation.
+ *
+ * The thread never touches memory owned by the garbage collector, so its
+ * state is allocated with malloc.
+ */
+struct read_ahead_chunk {
+    char data[PORT_BUFFER_SIZE];
+    ssize_t len;    // bytes read, 0 at eof, or -errno after an error
+    size_t pos;     // bytes already copied into the port buffer
+    int full;
+};
+
+struct read_ahead_state {
+    struct port_ops const *ops;     // the port's operations before
+    int fd;
+    int stop;
+    int next;       // the chunk the interpreter reads from next
+    struct read_ahead_chunk chunks[2];
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t emptied;
+    pthread_t thread;
+};
+
+
+static void *read_ahead_thread(void *arg)
+{
+    struct read_ahead_state *r = arg;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    for (int i = 0; ; i = !i) {
+        struct read_ahead_chunk *c = &r->chunks[i];
+        pthread_mutex_lock(&r->lock);
+        while (c->full && !r->stop) {
+            pthread_cond_wait(&r->emptied, &r->lock);
+        }
+        int stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+        if (stop) {
+            break;
+        }
+
+        // Closing the port cancels a read that is blocked.
+        ssize_t len;
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        do {
+            len = read(r->fd, c->data, PORT_BUFFER_SIZE);
+        } while (len < 0 && errno == EINTR);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+        pthread_mutex_lock(&r->lock);
+        c->len = len < 0 ? -errno : len;
+        c->pos = 0;
+        c->full = 1;
+        pthread_cond_signal(&r->filled);
+        pthread_mutex_unlock(&r->lock);
+        if (len <= 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+/* Starts reading input port p ahead in a background thread. The port's fill
+ * operation must be read(2) on its descriptor.
+ */
+void start_read_ahead(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    if (b->ops->fill != fd_fill) {
+        return;
+    }
+
+    struct read_ahead_state *r = calloc(1, sizeof(struct read_ahead_state));
+    if (r == NULL) {
+        error("unable to allocate read-ahead buffers:");
+    }
+    r->ops = b->ops;
+    r->fd = b->fd;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->filled, NULL);
+    pthread_cond_init(&r->emptied, NULL);
+
+    int err = pthread_create(&r->thread, NULL, read_ahead_thread, r);
+    if (err != 0) {
+        // Reading in the foreground still works.
+        free(r);
+        return;
+    }
+    b->state = r;
+    b->ops = &read_ahead_port_ops;
+}
+
+
+/* Makes stdin, and input pipes opened from now on, read-ahead ports.
+ */
+void enable_read_ahead(void)
+{
+    read_ahead = 1;
+    start_read_ahead(&standard_input_port);
+}
+
+
+static long read_ahead_fill(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    struct read_ahead_state *r = b->state;
+    struct read_ahead_chunk *c = &r->chunks[r->next];
+
+    pthread_mutex_lock(&r->lock);
+    while (!c->full) {
+        pthread_cond_wait(&r->filled, &r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    if (c->len < 0) {
+        errno = (int)-c->len;
+        error("error reading from port:");
+    } else if (c->len == 0) {
+        return 0;
+    }
+
+    size_t len = (size_t)c->len - c->pos;
+    if (len > b->size - b->end) {
+        len = b->size - b->end;
+    }
+    memcpy(b->data + b->end, c->data + c->pos, len);
+    c->pos += len;
+
+    if (c->pos == (size_t)c->len) {
+        pthread_mutex_lock(&r->lock);
+        c->full = 0;
+        pthread_cond_signal(&r->emptied);
+        pthread_mutex_unlock(&r->lock);
+        r->next = !r->next;
+    }
+    return (long)len;
+}
+
+
+static int read_ahead_ready(struct port_buffer *b)
+{
+    struct read_ahead_state *r = b->state;
+    pthread_mutex_lock(&r->lock);
+    int full = r->chunks[r->next].full;
+    pthread_mutex_unlock(&r->lock);
+    return full;
+}
+
+
+static void read_ahead_close(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    struct read_ahead_state *r = b->state;
+
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_signal(&r->emptied);
+    pthread_mutex_unlock(&r->lock);
+    pthread_cancel(r->thread);
+    pthread_join(r->thread, NULL);
+
+    b->ops = r->ops;
+    b->state = NULL;
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->filled);
+    pthread_cond_destroy(&r->emptied);
+    free(r);
+
+    if (b->ops->close != NULL) {
+        b->ops->close(p);
+    }
+}
+
+
+/* String ports keep their whole contents in the port buffer. An input string
+ * port starts out with a copy of s in its buffer; an output string port grows
+ * its buffer as it is written to.
+ */
+void open_string_port(object *p, char const *s)
+{
+    struct port_buffer *b;
+    if (p->value.port.mode == 1) {
+        b = make_port_buffer(&string_port_ops, -1, STRING_PORT_SIZE);
+    } else {
+        size_t len = strlen(s);
+        b = make_port_buffer(&string_port_ops, -1, len + 1);
+        memcpy(b->data, s, len);
+        b->end = len;
+    }
+
+    p->value.port.buffer = b;
+    p->value.port.state = 1;
+}
+
+
+int is_string_port(object *p)
+{
+    return is_port(p) && p->value.port.buffer->ops == &string_port_ops;
+}
+
+
+/* Returns a new string holding everything written to output string port p.
+ */
+char *get_output_string(object *p)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    char *s = GC_MALLOC_ATOMIC(b->end + 1);
+    if (s == NULL) {
+        error("unable to allocate string buffer:");
+    }
+
+    memcpy(s, b->data, b->end);
+    s[b->end] = '\0';
+    return s;
+}
+
+
+/* Reads more input into the buffer of p. Unconsumed bytes are moved to the
+ * front of the buffer first, and the buffer grows when they fill it, so any
+ * lookahead in progress stays valid. Returns the number of bytes read, or 0
+ * at end of file.
+ */
+long fill_port_buffer(object *p)
+{
+    if (port_is_closed(p)) {
+        error("port is closed");
+    }
+    if (port_is_eof(p)) {
+        return 0;
+    }
+
+    struct port_buffer *b = p->value.port.buffer;
+    if (b->ops->fill == NULL) {
+        // The whole contents are already in the buffer.
+        p->value.port.state = -1;
+        return 0;
+    }
+
+    if (b->pos > 0) {
+        memmove(b->data, b->data + b->pos, b->end - b->pos);
+        b->end -= b->pos;
+        b->pos = 0;
+    }
+
+    if (b->end == b->size) {
+        grow_port_buffer(b, b->size + 1);
+    }
+
+    // Make sure a prompt is visible before blocking on the terminal.
+    if (p == &standard_input_port) {
+        flush_port(&standard_output_port);
+    }
+
+    long bytes = b->ops->fill(p);
+    if (bytes == 0) {
+        p->value.port.state = -1;
+        return 0;
+    }
+
+    b->end += (size_t)bytes;
+    return bytes;
+}
+
+
+int read_char(object *p)
+{
+    if (port_is_closed(p)) {
+        error("port is closed");
     }
 
+    int c = port_lookahead(p, 0);
+    if (c != EOF) {
+        port_advance(p, 1);
+    }
     return c;
 }
 
 
-int peek_char(void)
+int peek_char(object *p)
 {
-    int c = read_char();
-    return ungetc(c, input_port->value.port.file);
+    if (port_is_closed(p)) {
+        error("port is closed");
+    }
+    return port_lookahead(p, 0);
 }
 
 
@@ -186,51 +979,261 @@ int peek_char(void)
  * to the resulting null-terminated string. Returns the number of
  * characters read, or -1 on EOF.
  */
-long read_line(char **bufptr)
+long read_line(object *p, char **bufptr)
 {
-    if (port_is_closed(input_port)) {
+    if (port_is_closed(p)) {
         error("port is closed");
     }
 
-    char *input_buffer = NULL;
-    size_t size = 128;
-    input_buffer = GC_REALLOC(input_buffer, size);
-    if (input_buffer == NULL) {
-        error("unable to allocate input buffer:");
-    }
-
-    int c = read_char();
+    struct port_buffer *b = p->value.port.buffer;
+    size_t len = 0;
+    int c = port_lookahead(p, 0);
     if (c == EOF) {
         *bufptr = NULL;
         return -1;
     }
 
-    long bytes = 1;
-    char *pos = input_buffer;
-    while (c != EOF && c != '\0') {
-        // resize the input buffer, if necessary.
-        if (bytes > (long)(size - 1)) {
-            size += 128;
-            input_buffer = GC_REALLOC(input_buffer, size);
-            if (input_buffer == NULL) {
-                error("unable to allocate input buffer:");
-            }
-            pos = input_buffer + bytes - 1;
+    // Scan the buffer in place, refilling as needed, and copy the line out
+    // once its end is known.
+    while (c != EOF && c != '\0' && c != '\n') {
+        char const *pos = b->data + b->pos + len;
+        char const *end = b->data + b->end;
+        while (pos < end && *pos != '\0' && *pos != '\n') {
+            pos++;
         }
+        len = (size_t)(pos - (b->data + b->pos));
+        c = port_lookahead(p, len);
+    }
+
+    size_t consumed = (c == EOF) ? len : len + 1;
+    size_t copied = (c == '\n') ? len + 1 : len;
+
+    char *input_buffer = GC_MALLOC_ATOMIC(copied + 1);
+    if (input_buffer == NULL) {
+        error("unable to allocate input buffer:");
+    }
+    memcpy(input_buffer, b->data + b->pos, copied);
+    input_buffer[copied] = '\0';
+    port_advance(p, consumed);
 
-        *pos++ = (char)c;
-        if (c == '\n') {
+    *bufptr = input_buffer;
+    return (long)consumed;
+}
+
+
+/* Copies up to len bytes from p into buf, and returns how many were copied.
+ * Only returns less than len at the end of the file.
+ */
+size_t read_bytes(object *p, char *buf, size_t len)
+{
+    if (port_is_closed(p)) {
+        error("port is closed");
+    }
+
+    struct port_buffer *b = p->value.port.buffer;
+    size_t copied = 0;
+    while (copied < len) {
+        if (b->pos == b->end && fill_port_buffer(p) == 0) {
             break;
         }
+        size_t chunk = b->end - b->pos;
+        if (chunk > len - copied) {
+            chunk = len - copied;
+        }
+        memcpy(buf + copied, b->data + b->pos, chunk);
+        b->pos += chunk;
+        copied += chunk;
+    }
+    return copied;
+}
 
-        c = read_char();
-        bytes++;
+
+/* Returns true if reading a character from p would not block. That's the
+ * case if there is input in the buffer, at the end of the file, and for
+ * ports whose input is all in memory.
+ */
+int char_ready(object *p)
+{
+    if (port_is_closed(p)) {
+        error("port is closed");
     }
 
-    *pos = '\0';
+    struct port_buffer *b = p->value.port.buffer;
+    if (b->pos < b->end || port_is_eof(p) || b->ops->fill == NULL) {
+        return 1;
+    } else if (b->ops == &read_ahead_port_ops) {
+        return read_ahead_ready(b);
+    }
 
-    *bufptr = input_buffer;
-    return bytes;
+    struct pollfd pfd = { .fd = b->fd, .events = POLLIN };
+    int n;
+    do {
+        n = poll(&pfd, 1, 0);
+    } while (n < 0 && errno == EINTR);
+    return n > 0;
+}
+
+
+void flush_port(object *p)
+{
+    if (port_is_closed(p)) {
+        return;
+    }
+
+    struct port_buffer *b = p->value.port.buffer;
+    if (b->ops->flush != NULL) {
+        b->ops->flush(p);
+    }
+}
+
+
+/* Flushes the standard ports and all other open output ports.
+ */
+void flush_output_ports(void)
+{
+    flush_port(&standard_output_port);
+    flush_port(&standard_error_port);
+    for (object *l = open_output_ports; !is_empty_list(l); l = cdr(l)) {
+        flush_port(car(l));
+    }
+}
+
+
+/* Makes a forked child forget the output ports it inherited, so that it
+ * doesn't close them at exit. Their buffers should have been flushed before
+ * forking, since both processes would write them otherwise.
+ */
+void forget_output_ports(void)
+{
+    open_output_ports = get_empty_list();
+}
+
+
+/* Flushes the standard ports and closes the other output ports at exit.
+ * Closing finishes compressed streams, and waits for output pipes.
+ */
+static void flush_all_ports(void)
+{
+    flush_port(&standard_output_port);
+    flush_port(&standard_error_port);
+    while (!is_empty_list(open_output_ports)) {
+        close_port(car(open_output_ports));
+    }
+}
+
+
+/* Copies bytes into the buffer of output port p, flushing it whenever it
+ * fills up. Ports with no flush operation keep everything they are given, so
+ * their buffer grows instead.
+ */
+static void put_bytes(object *p, char const *s, size_t len)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    int flush_line = b->line_buffered && memchr(s, '\n', len) != NULL;
+
+    if (b->ops->flush == NULL) {
+        if (len > b->size - b->end) {
+            grow_port_buffer(b, b->end + len);
+        }
+    } else {
+        while (len > b->size - b->end) {
+            size_t chunk = b->size - b->end;
+            memcpy(b->data + b->end, s, chunk);
+            b->end += chunk;
+            s += chunk;
+            len -= chunk;
+            b->ops->flush(p);
+        }
+    }
+
+    memcpy(b->data + b->end, s, len);
+    b->end += len;
+
+    if (flush_line) {
+        flush_port(p);
+    }
+}
+
+
+void write_port_bytes(object *p, char const *s, size_t len)
+{
+    if (port_is_closed(p)) {
+        error("port is closed");
+    }
+
+    put_bytes(p, s, len);
+}
+
+
+void write_output_bytes(char const *s, size_t len)
+{
+    write_port_bytes(output_port, s, len);
+}
+
+
+void write_output_string(char const *s)
+{
+    write_output_bytes(s, strlen(s));
+}
+
+
+void write_output_char(char c)
+{
+    write_output_bytes(&c, 1);
+}
+
+
+void write_output_number(long n)
+{
+    char digits[3 * sizeof(long) + 2];
+    char *pos = digits + sizeof(digits);
+
+    // Work with the magnitude as unsigned, so LONG_MIN doesn't overflow.
+    unsigned long magnitude = n < 0 ? 0UL - (unsigned long)n : (unsigned long)n;
+    do {
+        *--pos = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (n < 0) {
+        *--pos = '-';
+    }
+
+    write_output_bytes(pos, (size_t)(digits + sizeof(digits) - pos));
+}
+
+
+/* Formats straight into the port buffer when the result fits. */
+static void va_put_formatted(object *p, char const * const fmt, va_list args)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    va_list retry;
+    va_copy(retry, args);
+
+    size_t space = b->size - b->end;
+    int len = vsnprintf(b->data + b->end, space, fmt, args);
+    if (len < 0) {
+        va_end(retry);
+        error("unable to format output:");
+    }
+
+    if ((size_t)len < space) {
+        // vsnprintf wrote it straight into the buffer.
+        char *start = b->data + b->end;
+        b->end += (size_t)len;
+        if (b->line_buffered && memchr(start, '\n', (size_t)len) != NULL) {
+            flush_port(p);
+        }
+    } else {
+        char *buffer = GC_MALLOC_ATOMIC((size_t)len + 1);
+        if (buffer == NULL) {
+            va_end(retry);
+            error("unable to allocate output buffer:");
+        }
+        vsnprintf(buffer, (size_t)len + 1, fmt, retry);
+        put_bytes(p, buffer, (size_t)len);
+    }
+    va_end(retry);
 }
 
 
@@ -253,7 +1256,7 @@ void va_write_output(char const * const fmt, va_list args)
         error("port is closed");
     }
 
-    vfprintf(output_port->value.port.file, fmt, args);
+    va_put_formatted(output_port, fmt, args);
 }
 
 
@@ -278,6 +1281,7 @@ void va_write_error(char const * const fmt, va_list args)
         exit(2);
     }
 
-    vfprintf(error_port->value.port.file, fmt, args);
+    va_put_formatted(error_port, fmt, args);
+    flush_port(error_port);
 }
 
@@ -8,9 +8,50 @@
 #define PORT_H
 
 #include <stdarg.h>
+#include <stddef.h>
 
 #include "object.h"
 
+/* Ports read and write through a large block buffer.
+ *
+ * Input buffers are filled directly with read(2), and the lexer scans them in
+ * place; bytes between pos and end have been read from the file but not yet
+ * consumed. Regular files are mapped into memory instead, and the mapping is
+ * the buffer.
+ *
+ * Output buffers hold the bytes between 0 and end that have not been written
+ * yet. They are flushed with write(2) when they fill up, when the port is
+ * flushed or closed, at exit, and after every newline if the port is line
+ * buffered.
+ *
+ * Where the bytes come from and go to is up to the port's operations. Ports
+ * without a fill operation hold all of their input in the buffer from the
+ * start, and ports without a flush operation keep all of their output in it.
+ * Files whose names end in ".gz" are compressed: their fill operation
+ * inflates straight into the buffer, and their flush operation deflates it.
+ */
+#define PORT_BUFFER_SIZE 65536
+
+struct port_ops;
+
+struct port_buffer {
+    struct port_ops const *ops;
+    int fd;
+    char *data;
+    size_t pos;     // next unconsumed byte
+    size_t end;     // one past the last byte read
+    size_t size;    // allocated size of data
+    int line_buffered;
+    long pid;       // the child process at the other end of a pipe, or 0
+    void *state;    // anything else the port's operations keep track of
+};
+
+struct port_ops {
+    long (*fill)(object *p);    // read into the buffer after end; 0 at eof
+    void (*flush)(object *p);   // write out the buffer and empty it
+    void (*close)(object *p);
+};
+
 void init_standard_ports(void);
 
 object *get_standard_input_port(void);
@@ -27,15 +68,62 @@ void set_error_port(object *p);
 
 void open_port(object *p, char const *file);
 void close_port(object *p);
+void flush_port(object *p);
+void flush_output_ports(void);
+void forget_output_ports(void);
+
+void open_fd_port(object *p, int fd);
+void open_pipe_port(object *p, char const *command);
+void start_read_ahead(object *p);
+void enable_read_ahead(void);
+void open_process_port(object *p, char const *const *argv, long *status);
+
+void open_string_port(object *p, char const *s);
+int is_string_port(object *p);
+char *get_output_string(object *p);
 
 static inline int port_is_open(object *p) { return p->value.port.state == 1; }
 static inline int port_is_closed(object *p) { return p->value.port.state == 0; }
 static inline int port_is_eof(object *p) { return p->value.port.state == -1; }
 
-int read_char();
-int peek_char();
-long read_line(char **bufptr);
+long fill_port_buffer(object *p);
+
+/* Returns the byte offset characters past the read position of p, without
+ * consuming anything, or EOF. Refilling keeps the unconsumed bytes contiguous,
+ * so a token can be scanned with increasing offsets and then read in place.
+ */
+static inline int port_lookahead(object *p, size_t offset)
+{
+    struct port_buffer *b = p->value.port.buffer;
+    while (b->pos + offset >= b->end) {
+        if (fill_port_buffer(p) == 0) {
+            return EOF;
+        }
+    }
+    return (unsigned char)b->data[b->pos + offset];
+}
+
+static inline char const *port_position(object *p)
+{
+    return p->value.port.buffer->data + p->value.port.buffer->pos;
+}
+
+static inline void port_advance(object *p, size_t count)
+{
+    p->value.port.buffer->pos += count;
+}
+
+int read_char(object *p);
+int peek_char(object *p);
+long read_line(object *p, char **bufptr);
+size_t read_bytes(object *p, char *buf, size_t len);
+int char_ready(object *p);
 
+void write_port_bytes(object *p, char const *s, size_t len);
+void write_output_bytes(char const *s, size_t len);
+void write_output_string(char const *s);
+void write_output_char(char c);
+void write_output_number(long n);
 void write_output(char const * const fmt, ...);
 void va_write_output(char const * const fmt, va_list args);
 void write_error(char const * const fmt, ...);
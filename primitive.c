@@ -8,12 +8,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <ctype.h>
 #include <errno.h>
+#include <setjmp.h>
 #include "gc.h"
 
+#include "csv.h"
 #include "environment.h"
 #include "error.h"
 #include "eval.h"
+#include "fasl.h"
+#include "json.h"
 #include "object.h"
 #include "port.h"
 #include "primitive.h"
@@ -100,6 +105,24 @@
     }
 
 
+#define require_vector(arg, name) \
+    if (!is_vector(arg)) { \
+        error(name " called with non-vector argument"); \
+    }
+
+
+#define require_procedure(arg, name) \
+    if (!is_procedure(arg)) { \
+        error(name " called with non-procedure argument"); \
+    }
+
+
+#define require_list(arg, name) \
+    if (!is_list(arg)) { \
+        error(name " called with non-list argument"); \
+    }
+
+
 #define require_input_port(arg, name) \
     if (!is_input_port(arg)) { \
         error(name " called with non-input-port argument"); \
@@ -113,28 +136,145 @@
 
 
 /**** Equality and type predicates ****/
-static object *eq_proc(object *arguments)
+/* eq? has always compared numbers, characters and strings by value, so
+ * eqv?, which may not distinguish anything eq? doesn't, is the same test.
+ */
+static inline int is_eqv(object *o1, object *o2)
 {
-    require_exactly_two(arguments, "eq?");
-
-    object *o1 = car(arguments);
-    object *o2 = car(cdr(arguments));
-
-    if (o1->type != o2->type) {
-        return get_boolean(0);
+    if (o1 == o2) {
+        return 1;
+    } else if (o1->type != o2->type) {
+        return 0;
     }
 
     switch (o1->type) {
         case NUMBER:
-            return get_boolean(o1->value.number == o2->value.number);
+            return o1->value.number == o2->value.number;
         case CHARACTER:
-            return get_boolean(o1->value.character == o2->value.character);
+            return o1->value.character == o2->value.character;
         case STRING:
-            return get_boolean(
-                    strcmp(o1->value.string, o2->value.string) == 0);
+            return strcmp(o1->value.string, o2->value.string) == 0;
         default:
-            return get_boolean(o1 == o2);
+            return 0;
+    }
+}
+
+
+/* Pairs and vectors are compared with an explicit stack of the pairs of
+ * objects still to compare, following cdrs in a loop so that lists only use
+ * one stack entry at each level of nesting. Comparisons that run longer than
+ * EQUAL_CYCLE_CHECK steps start merging the containers they compare into
+ * equivalence classes, kept in a union-find table, and treat containers
+ * already in the same class as equal. That way circular structure doesn't
+ * compare forever.
+ */
+#define EQUAL_CYCLE_CHECK 100000
+
+
+static object *find_class(struct object_table *classes, object *obj)
+{
+    object *parent;
+    while ((parent = (object *)(size_t)object_table_get(classes, obj)) !=
+            NULL) {
+        obj = parent;
+    }
+    return obj;
+}
+
+
+static int is_equal(object *o1, object *o2)
+{
+    size_t count = 0, size = 64;
+    object **stack = GC_MALLOC(size * sizeof(object *));
+    if (stack == NULL) {
+        error("unable to allocate equal? stack:");
+    }
+    struct object_table *classes = NULL;
+    long steps = 0;
+
+    stack[count++] = o1;
+    stack[count++] = o2;
+    while (count > 0) {
+        o2 = stack[--count];
+        o1 = stack[--count];
+
+        while (o1 != o2) {
+            if (o1->type != o2->type) {
+                return 0;
+            } else if (o1->type == STRING) {
+                size_t len = strlen(o1->value.string);
+                if (len != strlen(o2->value.string) ||
+                        memcmp(o1->value.string, o2->value.string, len) != 0) {
+                    return 0;
+                }
+                break;
+            } else if (o1->type != PAIR && o1->type != VECTOR) {
+                if (!is_eqv(o1, o2)) {
+                    return 0;
+                }
+                break;
+            }
+
+            if (++steps > EQUAL_CYCLE_CHECK) {
+                if (classes == NULL) {
+                    classes = make_object_table();
+                }
+                object *c1 = find_class(classes, o1);
+                object *c2 = find_class(classes, o2);
+                if (c1 == c2) {
+                    break;
+                }
+                object_table_put(classes, c1, (long)(size_t)c2);
+            }
+
+            long items = o1->type == PAIR ? 1 : o1->value.vector.length;
+            if (o1->type == VECTOR && items != o2->value.vector.length) {
+                return 0;
+            }
+            while (count + 2 * (size_t)items > size) {
+                size *= 2;
+                stack = GC_REALLOC(stack, size * sizeof(object *));
+                if (stack == NULL) {
+                    error("unable to grow equal? stack:");
+                }
+            }
+
+            if (o1->type == PAIR) {
+                stack[count++] = car(o1);
+                stack[count++] = car(o2);
+                o1 = cdr(o1);
+                o2 = cdr(o2);
+            } else {
+                for (long i = 0; i < items; i++) {
+                    stack[count++] = o1->value.vector.items[i];
+                    stack[count++] = o2->value.vector.items[i];
+                }
+                break;
+            }
+        }
     }
+    return 1;
+}
+
+
+static object *eq_proc(object *arguments)
+{
+    require_exactly_two(arguments, "eq?");
+    return get_boolean(is_eqv(car(arguments), car(cdr(arguments))));
+}
+
+
+static object *eqv_proc(object *arguments)
+{
+    require_exactly_two(arguments, "eqv?");
+    return get_boolean(is_eqv(car(arguments), car(cdr(arguments))));
+}
+
+
+static object *equal_proc(object *arguments)
+{
+    require_exactly_two(arguments, "equal?");
+    return get_boolean(is_equal(car(arguments), car(cdr(arguments))));
 }
 
 
@@ -424,291 +564,1583 @@ static object *list_proc(object *arguments)
 }
 
 
-/**** String manipulation ****/
-static object *string_append_proc(object *arguments)
+/**** List operations ****/
+
+/* These build their results front to back through a tail pointer, and only
+ * call into the evaluator to apply procedures they are passed. None of them
+ * use C stack in proportion to the length of a list.
+ */
+
+/* Appends obj to the list whose first and last pairs are *head and *tail.
+ */
+static inline void append_to(object **head, object **tail, object *obj)
 {
-    require_at_least_one(arguments, "string-append");
+    object *pair = cons(obj, get_empty_list());
+    if (*tail == NULL) {
+        *head = pair;
+    } else {
+        set_cdr(*tail, pair);
+    }
+    *tail = pair;
+}
 
-    long unsigned len = 0;
-    object *s = arguments;
-    while (!is_empty_list(s)) {
-        require_string(car(s), "string-append");
-        len += strlen(car(s)->value.string);
-        s = cdr(s);
+
+static object *copy_list(object *list)
+{
+    object *head = get_empty_list();
+    object *tail = NULL;
+    for (; is_pair(list); list = cdr(list)) {
+        append_to(&head, &tail, car(list));
     }
 
-    char *buf = GC_MALLOC(len + 1);
-    char *pos = buf;
-    s = arguments;
-    while (!is_empty_list(s)) {
-        strcpy(pos, car(s)->value.string);
-        pos += strlen(pos);
-        s = cdr(s);
+    // Like append, an improper tail is kept rather than rejected.
+    if (tail == NULL) {
+        return list;
     }
+    set_cdr(tail, list);
+    return head;
+}
 
-    *pos = '\0';
 
-    return make_string(buf);
+/* Returns a list of the cars of lists, and advances each list to its cdr, or
+ * returns NULL if any of them is empty. lists must be a copy that is private
+ * to the caller, since apply may pass on a list that belongs to the user.
+ */
+static object *next_arguments(object *lists, char const *name)
+{
+    object *head = get_empty_list();
+    object *tail = NULL;
+    for (; !is_empty_list(lists); lists = cdr(lists)) {
+        object *list = car(lists);
+        if (is_empty_list(list)) {
+            return NULL;
+        } else if (!is_pair(list)) {
+            error("%s called with non-list argument", name);
+        }
+        append_to(&head, &tail, car(list));
+        set_car(lists, cdr(list));
+    }
+    return head;
 }
 
 
-/**** Type conversion ****/
-static object *char_to_integer_proc(object *arguments)
+static object *map_proc(object *arguments)
 {
-    require_exactly_one(arguments, "char->integer");
-    require_character(car(arguments), "char->integer");
+    require_at_least_two(arguments, "map");
+    require_procedure(car(arguments), "map");
+
+    object *proc = car(arguments);
+    object *head = get_empty_list();
+    object *tail = NULL;
+
+    if (is_empty_list(cdr(cdr(arguments)))) {
+        object *list = car(cdr(arguments));
+        for (; is_pair(list); list = cdr(list)) {
+            append_to(&head, &tail,
+                    bs_apply(proc, cons(car(list), get_empty_list())));
+        }
+        require_list(list, "map");
+        return head;
+    }
 
-    char value = car(arguments)->value.character;
-    return make_number(value);
+    object *lists = copy_list(cdr(arguments));
+    object *args;
+    while ((args = next_arguments(lists, "map")) != NULL) {
+        append_to(&head, &tail, bs_apply(proc, args));
+    }
+    return head;
 }
 
 
-static object *integer_to_char_proc(object *arguments)
+static object *for_each_proc(object *arguments)
 {
-    require_exactly_one(arguments, "integer->char");
-    require_number(car(arguments), "integer->char");
-
-    long value = car(arguments)->value.number;
-    if (value > CHAR_MAX || value < CHAR_MIN) {
-        error("integer out of range for conversion to char");
+    require_at_least_two(arguments, "for-each");
+    require_procedure(car(arguments), "for-each");
+
+    object *proc = car(arguments);
+    object *lists = copy_list(cdr(arguments));
+    object *args;
+    while ((args = next_arguments(lists, "for-each")) != NULL) {
+        bs_apply(proc, args);
     }
-
-    return make_character((char) value);
+    return lookup_symbol("ok");
 }
 
 
-static object *number_to_string_proc(object *arguments)
+static object *fold_left_proc(object *arguments)
 {
-    require_exactly_one(arguments, "number->string");
-    require_number(car(arguments), "number->string");
+    require_at_least_two(arguments, "fold-left");
+    require_procedure(car(arguments), "fold-left");
+    if (is_empty_list(cdr(cdr(arguments)))) {
+        error("fold-left requires at least three arguments");
+    }
 
-    long value = car(arguments)->value.number;
-    long num = value;
-    unsigned digits = 0;
-    if (num <= 0) {
-        digits += 1;
-        num *= -1;
+    object *proc = car(arguments);
+    object *result = car(cdr(arguments));
+    object *lists = copy_list(cdr(cdr(arguments)));
+    object *args;
+    while ((args = next_arguments(lists, "fold-left")) != NULL) {
+        result = bs_apply(proc, cons(result, args));
     }
+    return result;
+}
 
-    while (num) {
-        num /= 10;
-        digits++;
+
+static object *fold_right_proc(object *arguments)
+{
+    require_at_least_two(arguments, "fold-right");
+    require_procedure(car(arguments), "fold-right");
+    if (is_empty_list(cdr(cdr(arguments)))) {
+        error("fold-right requires at least three arguments");
     }
 
-    char *buffer = GC_MALLOC(digits + 1);
-    if (buffer == NULL) {
-        error("unable to allocate string buffer:");
+    // Collect the argument lists for each step, then apply proc to them
+    // from the last step to the first.
+    object *proc = car(arguments);
+    object *lists = copy_list(cdr(cdr(arguments)));
+    object *steps = get_empty_list();
+    object *args;
+    while ((args = next_arguments(lists, "fold-right")) != NULL) {
+        steps = cons(args, steps);
     }
-    snprintf(buffer, digits + 1, "%ld", value);
 
-    return make_string(buffer);
+    object *result = car(cdr(arguments));
+    for (; !is_empty_list(steps); steps = cdr(steps)) {
+        args = car(steps);
+        object *last = args;
+        while (!is_empty_list(cdr(last))) {
+            last = cdr(last);
+        }
+        set_cdr(last, cons(result, get_empty_list()));
+        result = bs_apply(proc, args);
+    }
+    return result;
 }
 
 
-static object *string_to_number_proc(object *arguments)
+static object *reverse_proc(object *arguments)
 {
-    require_exactly_one(arguments, "string->number");
-    require_string(car(arguments), "string->number");
-
-    char const *s = car(arguments)->value.string;
-    char *end;
-    errno = 0;
-    long num = strtol(s, &end, 0);
+    require_exactly_one(arguments, "reverse");
 
-    if (end != (s + strlen(s))) {
-        error("string->number argument does not look like a number");
-    } else if (errno) {
-        error("unable to convert string to number:");
+    object *result = get_empty_list();
+    object *list = car(arguments);
+    for (; is_pair(list); list = cdr(list)) {
+        result = cons(car(list), result);
     }
-
-    return make_number(num);
+    require_list(list, "reverse");
+    return result;
 }
 
 
-static object *symbol_to_string_proc(object *arguments)
+static object *append_proc(object *arguments)
 {
-    require_exactly_one(arguments, "symbol->string");
-    require_symbol(car(arguments), "symbol->string");
+    if (is_empty_list(arguments)) {
+        return get_empty_list();
+    }
 
-    char const *sym = car(arguments)->value.symbol;
-    char *str = GC_MALLOC(strlen(sym) + 1);
-    if (str == NULL) {
-        error("unable to allocate string buffer:");
+    // Every list but the last is copied; the last becomes the tail.
+    object *head = get_empty_list();
+    object *tail = NULL;
+    for (; !is_empty_list(cdr(arguments)); arguments = cdr(arguments)) {
+        object *list = car(arguments);
+        for (; is_pair(list); list = cdr(list)) {
+            append_to(&head, &tail, car(list));
+        }
+        require_list(list, "append");
     }
-    strcpy(str, sym);
-    return make_string(str);
+
+    if (tail == NULL) {
+        return car(arguments);
+    }
+    set_cdr(tail, car(arguments));
+    return head;
 }
 
 
-static object *string_to_symbol_proc(object *arguments)
+static object *append_bang_proc(object *arguments)
 {
-    /* This procedure can create a symbol that contains invalid characters. */
-    require_exactly_one(arguments, "string->symbol");
-    require_string(car(arguments), "string->symbol");
+    object *head = get_empty_list();
+    object *tail = NULL;
 
-    char const *str = car(arguments)->value.string;
-    char *sym = GC_MALLOC(strlen(str) + 1);
-    if (sym == NULL) {
-        error("unable to allocate symbol buffer:");
+    for (; !is_empty_list(arguments); arguments = cdr(arguments)) {
+        object *list = car(arguments);
+        if (is_empty_list(list)) {
+            continue;
+        }
+
+        if (tail == NULL) {
+            head = list;
+        } else {
+            set_cdr(tail, list);
+        }
+        if (is_empty_list(cdr(arguments))) {
+            break;
+        }
+
+        require_pair(list, "append!");
+        while (is_pair(cdr(list))) {
+            list = cdr(list);
+        }
+        tail = list;
     }
-    strcpy(sym, str);
-    return make_symbol(sym);
+    return head;
 }
 
 
-/**** Input/Output ****/
-static object *current_input_port_proc(object *arguments)
+static object *list_tail(object *list, long k, char const *name)
 {
-    require_zero(arguments, "current-input-port");
-    return get_input_port();
+    for (; k > 0; k--) {
+        if (!is_pair(list)) {
+            error("%s index is out of range", name);
+        }
+        list = cdr(list);
+    }
+    return list;
 }
 
 
-static object *current_output_port_proc(object *arguments)
+static object *list_tail_proc(object *arguments)
 {
-    require_zero(arguments, "current-output-port");
-    return get_output_port();
+    require_exactly_two(arguments, "list-tail");
+    require_number(car(cdr(arguments)), "list-tail");
+    return list_tail(car(arguments), car(cdr(arguments))->value.number,
+            "list-tail");
 }
 
 
-static object *open_input_file_proc(object *arguments)
+static object *list_ref_proc(object *arguments)
 {
-    require_exactly_one(arguments, "open-input-file");
-    require_string(car(arguments), "open-input-file");
+    require_exactly_two(arguments, "list-ref");
+    require_number(car(cdr(arguments)), "list-ref");
 
-    return make_input_port(car(arguments)->value.string);
+    object *list = list_tail(car(arguments),
+            car(cdr(arguments))->value.number, "list-ref");
+    if (!is_pair(list)) {
+        error("list-ref index is out of range");
+    }
+    return car(list);
 }
 
 
-static object *open_output_file_proc(object *arguments)
+static object *list_copy_proc(object *arguments)
 {
-    require_exactly_one(arguments, "open-output-file");
-    require_string(car(arguments), "open-output-file");
-
-    return make_output_port(car(arguments)->value.string);
+    require_exactly_one(arguments, "list-copy");
+    return copy_list(car(arguments));
 }
 
 
-static object *close_input_port_proc(object *arguments)
+static object *last_pair_proc(object *arguments)
 {
-    require_exactly_one(arguments, "close-input-file");
-    require_input_port(car(arguments), "close-input-file");
+    require_exactly_one(arguments, "last-pair");
+    require_pair(car(arguments), "last-pair");
 
-    close_port(car(arguments));
-    return lookup_symbol("ok");
+    object *list = car(arguments);
+    while (is_pair(cdr(list))) {
+        list = cdr(list);
+    }
+    return list;
 }
 
 
-static object *close_output_port_proc(object *arguments)
-{
-    require_exactly_one(arguments, "close-output-port");
-    require_output_port(car(arguments), "close-output-port");
+/* The member and assoc families. member and assoc take an optional procedure
+ * to compare with instead of equal?.
+ */
+enum match {
+    MATCH_EQ,
+    MATCH_EQUAL,
+    MATCH_PROC
+};
 
-    close_port(car(arguments));
-    return lookup_symbol("ok");
+
+static inline int matches(enum match how, object *proc, object *key,
+        object *obj)
+{
+    switch (how) {
+        case MATCH_EQ:
+            return is_eqv(key, obj);
+        case MATCH_EQUAL:
+            return is_equal(key, obj);
+        default:
+            return is_true(bs_apply(proc,
+                        cons(key, cons(obj, get_empty_list()))));
+    }
 }
 
 
-static object *read_proc(object *arguments)
+/* Checks the arguments of a member or assoc procedure, and returns the
+ * comparison procedure if one was given, updating how to match.
+ */
+static object *match_procedure(object *arguments, enum match *how,
+        char const *name)
 {
-    require_at_most_one(arguments, "read");
-
-    object *prev_port = get_input_port();
-    object *result;
+    if (is_empty_list(arguments) || is_empty_list(cdr(arguments)) ||
+            (!is_empty_list(cdr(cdr(arguments))) &&
+             (*how != MATCH_EQUAL ||
+              !is_empty_list(cdr(cdr(cdr(arguments))))))) {
+        error("%s called with the wrong number of arguments", name);
+    }
 
-    if (is_empty_list(arguments)) {
-        set_input_port(get_standard_input_port());
-        result = bs_read();
-    } else {
-        require_input_port(car(arguments), "read");
-        set_input_port(car(arguments));
-        result = bs_read();
+    if (is_empty_list(cdr(cdr(arguments)))) {
+        return NULL;
     }
-        set_input_port(prev_port);
-        return result;
+    object *proc = car(cdr(cdr(arguments)));
+    if (!is_procedure(proc)) {
+        error("%s called with non-procedure argument", name);
+    }
+    *how = MATCH_PROC;
+    return proc;
 }
 
 
-static object *read_char_proc(object *arguments)
+static object *member(object *arguments, enum match how, char const *name)
 {
-    require_at_most_one(arguments, "read-char");
-
-    object *prev_port = get_input_port();
-    int c;
+    object *proc = match_procedure(arguments, &how, name);
+    object *key = car(arguments);
+    object *list = car(cdr(arguments));
 
-    if (is_empty_list(arguments)) {
-        set_input_port(get_standard_input_port());
-        c = read_char();
-    } else {
-        require_input_port(car(arguments), "read-char");
-        set_input_port(car(arguments));
-        c = read_char();
+    for (; is_pair(list); list = cdr(list)) {
+        if (matches(how, proc, key, car(list))) {
+            return list;
+        }
     }
-    set_input_port(prev_port);
-
-    if (c == EOF) {
-        return get_end_of_file();
-    } else {
-        return make_character((char)c);
+    if (!is_empty_list(list)) {
+        error("%s called with non-list argument", name);
     }
+    return get_boolean(0);
 }
 
 
-static object *peek_char_proc(object *arguments)
+static object *assoc(object *arguments, enum match how, char const *name)
 {
-    require_at_most_one(arguments, "peek-char");
-
-    object *prev_port = get_input_port();
-    int c;
-
-    if (is_empty_list(arguments)) {
-        set_input_port(get_standard_input_port());
-        c = peek_char();
-    } else {
-        require_input_port(car(arguments), "peek-char");
-        set_input_port(car(arguments));
-        c = peek_char();
+    object *proc = match_procedure(arguments, &how, name);
+    object *key = car(arguments);
+    object *alist = car(cdr(arguments));
+
+    for (; is_pair(alist); alist = cdr(alist)) {
+        object *entry = car(alist);
+        if (!is_pair(entry)) {
+            error("%s called with a list that is not an association list",
+                    name);
+        }
+        if (matches(how, proc, key, car(entry))) {
+            return entry;
+        }
     }
-    set_input_port(prev_port);
-
-    if (c == EOF) {
-        return get_end_of_file();
-    } else {
-        return make_character((char)c);
+    if (!is_empty_list(alist)) {
+        error("%s called with non-list argument", name);
     }
+    return get_boolean(0);
 }
 
 
-static object *write_proc(object *arguments)
+static object *memq_proc(object *arguments)
 {
-    require_one_or_two(arguments, "write");
+    return member(arguments, MATCH_EQ, "memq");
+}
 
-    if (is_empty_list(cdr(arguments))) {
-        bs_write(car(arguments));
-    } else {
-        require_output_port(car(cdr(arguments)), "write");
-        object *prev_port = get_output_port();
-        set_output_port(car(cdr(arguments)));
-        bs_write(car(arguments));
-        set_output_port(prev_port);
-    }
 
-    return lookup_symbol("ok");
+static object *memv_proc(object *arguments)
+{
+    return member(arguments, MATCH_EQ, "memv");
 }
 
 
-static object *write_char_proc(object *arguments)
+static object *member_proc(object *arguments)
 {
-    require_one_or_two(arguments, "write-char");
+    return member(arguments, MATCH_EQUAL, "member");
+}
+
+
+static object *assq_proc(object *arguments)
+{
+    return assoc(arguments, MATCH_EQ, "assq");
+}
+
+
+static object *assv_proc(object *arguments)
+{
+    return assoc(arguments, MATCH_EQ, "assv");
+}
+
+
+static object *assoc_proc(object *arguments)
+{
+    return assoc(arguments, MATCH_EQUAL, "assoc");
+}
+
+
+/* Applies the car and cdr operations spelled out by path, from right to left,
+ * as in the name of the procedure.
+ */
+static object *cxr(object *arguments, char const *path, char const *name)
+{
+    if (is_empty_list(arguments) || !is_empty_list(cdr(arguments))) {
+        error("%s requires a single argument", name);
+    }
+
+    object *obj = car(arguments);
+    for (size_t i = strlen(path); i > 0; i--) {
+        if (!is_pair(obj)) {
+            error("%s called with an argument of the wrong shape", name);
+        }
+        obj = path[i - 1] == 'a' ? car(obj) : cdr(obj);
+    }
+    return obj;
+}
+
+
+#define define_cxr(path) \
+    static object *c##path##r_proc(object *arguments) \
+    { \
+        return cxr(arguments, #path, "c" #path "r"); \
+    }
+
+define_cxr(aa)
+define_cxr(ad)
+define_cxr(da)
+define_cxr(dd)
+define_cxr(aaa)
+define_cxr(aad)
+define_cxr(ada)
+define_cxr(add)
+define_cxr(daa)
+define_cxr(dad)
+define_cxr(dda)
+define_cxr(ddd)
+define_cxr(aaaa)
+define_cxr(aaad)
+define_cxr(aada)
+define_cxr(aadd)
+define_cxr(adaa)
+define_cxr(adad)
+define_cxr(adda)
+define_cxr(addd)
+define_cxr(daaa)
+define_cxr(daad)
+define_cxr(dada)
+define_cxr(dadd)
+define_cxr(ddaa)
+define_cxr(ddad)
+define_cxr(ddda)
+define_cxr(dddd)
+
+
+/**** Vectors ****/
+static object *is_vector_proc(object *arguments)
+{
+    require_exactly_one(arguments, "vector?");
+    return get_boolean(is_vector(car(arguments)));
+}
+
+
+static object *make_vector_proc(object *arguments)
+{
+    require_one_or_two(arguments, "make-vector");
+    require_number(car(arguments), "make-vector");
+
+    long length = car(arguments)->value.number;
+    if (length < 0) {
+        error("make-vector called with a negative length");
+    }
+    object *fill = is_empty_list(cdr(arguments)) ?
+        get_boolean(0) : car(cdr(arguments));
+    return make_vector(length, fill);
+}
+
+
+static object *list_to_vector(object *list, char const *name)
+{
+    long length = 0;
+    object *l;
+    for (l = list; is_pair(l); l = cdr(l)) {
+        length++;
+    }
+    if (!is_empty_list(l)) {
+        error("%s called with non-list argument", name);
+    }
+
+    object *v = make_vector(length, get_empty_list());
+    for (long i = 0; i < length; i++) {
+        v->value.vector.items[i] = car(list);
+        list = cdr(list);
+    }
+    return v;
+}
+
+
+static object *vector_proc(object *arguments)
+{
+    return list_to_vector(arguments, "vector");
+}
+
+
+static object *vector_length_proc(object *arguments)
+{
+    require_exactly_one(arguments, "vector-length");
+    require_vector(car(arguments), "vector-length");
+    return make_number(car(arguments)->value.vector.length);
+}
+
+
+/* Returns the address of the element of vector v at index k, checking both.
+ */
+static object **vector_slot(object *v, object *k, char const *name)
+{
+    if (!is_vector(v)) {
+        error("%s called with non-vector argument", name);
+    } else if (!is_number(k)) {
+        error("%s called with non-numeric argument", name);
+    } else if (k->value.number < 0 ||
+            k->value.number >= v->value.vector.length) {
+        error("%s index is out of range", name);
+    }
+    return &v->value.vector.items[k->value.number];
+}
+
+
+static object *vector_ref_proc(object *arguments)
+{
+    require_exactly_two(arguments, "vector-ref");
+    return *vector_slot(car(arguments), car(cdr(arguments)), "vector-ref");
+}
+
+
+static object *vector_set_proc(object *arguments)
+{
+    if (is_empty_list(arguments) || is_empty_list(cdr(arguments)) ||
+            is_empty_list(cdr(cdr(arguments))) ||
+            !is_empty_list(cdr(cdr(cdr(arguments))))) {
+        error("vector-set! requires three arguments");
+    }
+    *vector_slot(car(arguments), car(cdr(arguments)), "vector-set!") =
+        car(cdr(cdr(arguments)));
+    return lookup_symbol("ok");
+}
+
+
+static object *vector_to_list_proc(object *arguments)
+{
+    require_exactly_one(arguments, "vector->list");
+    require_vector(car(arguments), "vector->list");
+
+    object *v = car(arguments);
+    object *list = get_empty_list();
+    for (long i = v->value.vector.length - 1; i >= 0; i--) {
+        list = cons(v->value.vector.items[i], list);
+    }
+    return list;
+}
+
+
+static object *list_to_vector_proc(object *arguments)
+{
+    require_exactly_one(arguments, "list->vector");
+    return list_to_vector(car(arguments), "list->vector");
+}
+
+
+/**** String manipulation ****/
+static object *string_append_proc(object *arguments)
+{
+    require_at_least_one(arguments, "string-append");
+
+    long unsigned len = 0;
+    object *s = arguments;
+    while (!is_empty_list(s)) {
+        require_string(car(s), "string-append");
+        len += strlen(car(s)->value.string);
+        s = cdr(s);
+    }
+
+    char *buf = GC_MALLOC(len + 1);
+    char *pos = buf;
+    s = arguments;
+    while (!is_empty_list(s)) {
+        strcpy(pos, car(s)->value.string);
+        pos += strlen(pos);
+        s = cdr(s);
+    }
+
+    *pos = '\0';
+
+    return make_string(buf);
+}
+
+
+/* Strings are nul-terminated byte buffers. The procedures below find their
+ * way through them with the C library's memchr, strstr and friends, which
+ * compare many bytes at a time.
+ */
+static char *alloc_string(size_t len)
+{
+    char *buf = GC_MALLOC_ATOMIC(len + 1);
+    if (buf == NULL) {
+        error("unable to allocate string buffer:");
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+
+static object *make_substring(char const *start, size_t len)
+{
+    char *buf = alloc_string(len);
+    memcpy(buf, start, len);
+    return make_string(buf);
+}
+
+
+/* Returns the value of the index argument k, which must be between 0 and
+ * limit inclusive.
+ */
+static long string_index(object *k, long limit, char const *name)
+{
+    if (!is_number(k)) {
+        error("%s called with non-numeric argument", name);
+    } else if (k->value.number < 0 || k->value.number > limit) {
+        error("%s index is out of range", name);
+    }
+    return k->value.number;
+}
+
+
+static object *string_length_proc(object *arguments)
+{
+    require_exactly_one(arguments, "string-length");
+    require_string(car(arguments), "string-length");
+    return make_number((long)strlen(car(arguments)->value.string));
+}
+
+
+static object *string_ref_proc(object *arguments)
+{
+    require_exactly_two(arguments, "string-ref");
+    require_string(car(arguments), "string-ref");
+
+    char const *s = car(arguments)->value.string;
+    long k = string_index(car(cdr(arguments)), (long)strlen(s) - 1,
+            "string-ref");
+    return make_character(s[k]);
+}
+
+
+static object *substring_proc(object *arguments)
+{
+    require_at_least_two(arguments, "substring");
+    require_string(car(arguments), "substring");
+
+    char const *s = car(arguments)->value.string;
+    long len = (long)strlen(s);
+    long start = string_index(car(cdr(arguments)), len, "substring");
+    long end = len;
+    object *rest = cdr(cdr(arguments));
+    if (!is_empty_list(rest)) {
+        if (!is_empty_list(cdr(rest))) {
+            error("substring takes at most three arguments");
+        }
+        end = string_index(car(rest), len, "substring");
+    }
+    if (end < start) {
+        error("substring end is before its start");
+    }
+    return make_substring(s + start, (size_t)(end - start));
+}
+
+
+/* Returns the optional start argument of a search, in rest.
+ */
+static long search_start(object *rest, long len, char const *name)
+{
+    if (is_empty_list(rest)) {
+        return 0;
+    } else if (!is_empty_list(cdr(rest))) {
+        error("%s called with too many arguments", name);
+    }
+    return string_index(car(rest), len, name);
+}
+
+
+static object *string_index_proc(object *arguments)
+{
+    require_at_least_two(arguments, "string-index");
+    require_string(car(arguments), "string-index");
+    require_character(car(cdr(arguments)), "string-index");
+
+    char const *s = car(arguments)->value.string;
+    long len = (long)strlen(s);
+    long start = search_start(cdr(cdr(arguments)), len, "string-index");
+    char const *found = memchr(s + start, car(cdr(arguments))->value.character,
+            (size_t)(len - start));
+    return found == NULL ? get_boolean(0) : make_number(found - s);
+}
+
+
+static object *string_search_forward_proc(object *arguments)
+{
+    require_at_least_two(arguments, "string-search-forward");
+    require_string(car(arguments), "string-search-forward");
+    require_string(car(cdr(arguments)), "string-search-forward");
+
+    char const *pattern = car(arguments)->value.string;
+    char const *s = car(cdr(arguments))->value.string;
+    long start = search_start(cdr(cdr(arguments)), (long)strlen(s),
+            "string-search-forward");
+    char const *found = strstr(s + start, pattern);
+    return found == NULL ? get_boolean(0) : make_number(found - s);
+}
+
+
+static object *string_split_proc(object *arguments)
+{
+    require_exactly_two(arguments, "string-split");
+    require_string(car(arguments), "string-split");
+    require_character(car(cdr(arguments)), "string-split");
+
+    char const *s = car(arguments)->value.string;
+    char const *end = s + strlen(s);
+    char delimiter = car(cdr(arguments))->value.character;
+
+    object *head = get_empty_list();
+    object *tail = NULL;
+    for (;;) {
+        char const *found = memchr(s, delimiter, (size_t)(end - s));
+        char const *stop = found == NULL ? end : found;
+        append_to(&head, &tail, make_substring(s, (size_t)(stop - s)));
+        if (found == NULL) {
+            return head;
+        }
+        s = found + 1;
+    }
+}
+
+
+static object *string_join_proc(object *arguments)
+{
+    require_one_or_two(arguments, "string-join");
+
+    char const *separator = " ";
+    if (!is_empty_list(cdr(arguments))) {
+        require_string(car(cdr(arguments)), "string-join");
+        separator = car(cdr(arguments))->value.string;
+    }
+    size_t separator_len = strlen(separator);
+
+    size_t len = 0;
+    object *list;
+    for (list = car(arguments); is_pair(list); list = cdr(list)) {
+        require_string(car(list), "string-join");
+        len += strlen(car(list)->value.string);
+        if (is_pair(cdr(list))) {
+            len += separator_len;
+        }
+    }
+    require_list(list, "string-join");
+
+    char *buf = alloc_string(len);
+    char *pos = buf;
+    for (list = car(arguments); is_pair(list); list = cdr(list)) {
+        size_t item_len = strlen(car(list)->value.string);
+        memcpy(pos, car(list)->value.string, item_len);
+        pos += item_len;
+        if (is_pair(cdr(list))) {
+            memcpy(pos, separator, separator_len);
+            pos += separator_len;
+        }
+    }
+    return make_string(buf);
+}
+
+
+static object *convert_case(object *arguments, int (*convert)(int),
+        char const *name)
+{
+    if (is_empty_list(arguments) || !is_empty_list(cdr(arguments))) {
+        error("%s requires a single argument", name);
+    } else if (!is_string(car(arguments))) {
+        error("%s called with non-string argument", name);
+    }
+
+    char const *s = car(arguments)->value.string;
+    size_t len = strlen(s);
+    char *buf = alloc_string(len);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (char)convert((unsigned char)s[i]);
+    }
+    return make_string(buf);
+}
+
+
+static object *string_upcase_proc(object *arguments)
+{
+    return convert_case(arguments, toupper, "string-upcase");
+}
+
+
+static object *string_downcase_proc(object *arguments)
+{
+    return convert_case(arguments, tolower, "string-downcase");
+}
+
+
+/* Returns true if each pair of adjacent arguments is ordered as required:
+ * the same if less is false, or strictly increasing if it is true.
+ */
+static object *compare_strings(object *arguments, int less, char const *name)
+{
+    if (is_empty_list(arguments) || is_empty_list(cdr(arguments))) {
+        error("%s requires at least two arguments", name);
+    }
+
+    for (; !is_empty_list(cdr(arguments)); arguments = cdr(arguments)) {
+        object *s1 = car(arguments);
+        object *s2 = car(cdr(arguments));
+        if (!is_string(s1) || !is_string(s2)) {
+            error("%s called with non-string argument", name);
+        }
+        int order = strcmp(s1->value.string, s2->value.string);
+        if (less ? order >= 0 : order != 0) {
+            return get_boolean(0);
+        }
+    }
+    return get_boolean(1);
+}
+
+
+static object *string_eq_proc(object *arguments)
+{
+    return compare_strings(arguments, 0, "string=?");
+}
+
+
+static object *string_lt_proc(object *arguments)
+{
+    return compare_strings(arguments, 1, "string<?");
+}
+
+
+/* Hashes with FNV-1a. The result is a non-negative number, reduced modulo
+ * the optional second argument.
+ */
+static object *string_hash_proc(object *arguments)
+{
+    require_one_or_two(arguments, "string-hash");
+    require_string(car(arguments), "string-hash");
+
+    unsigned long hash = 2166136261UL;
+    for (char const *s = car(arguments)->value.string; *s != '\0'; s++) {
+        hash ^= (unsigned char)*s;
+        hash *= 16777619UL;
+    }
+    hash &= LONG_MAX;
+
+    if (!is_empty_list(cdr(arguments))) {
+        require_number(car(cdr(arguments)), "string-hash");
+        long modulus = car(cdr(arguments))->value.number;
+        if (modulus <= 0) {
+            error("string-hash modulus must be positive");
+        }
+        hash %= (unsigned long)modulus;
+    }
+    return make_number((long)hash);
+}
+
+
+/**** Sorting ****/
+
+/* Lists are sorted with a stable bottom-up merge sort that relinks their
+ * pairs, and vectors with an introsort, which is quicksort that falls back to
+ * heapsort if it recurses too deeply. Sorting numbers with < or strings with
+ * string<? compares them directly, without going through the evaluator.
+ */
+typedef int (*less_fn)(object *proc, object *a, object *b);
+
+
+static int less_apply(object *proc, object *a, object *b)
+{
+    return is_true(bs_apply(proc, cons(a, cons(b, get_empty_list()))));
+}
+
+
+static int less_numbers(object *proc, object *a, object *b)
+{
+    (void)proc;     // unused argument.
+    return a->value.number < b->value.number;
+}
+
+
+static int less_strings(object *proc, object *a, object *b)
+{
+    (void)proc;     // unused argument.
+    return strcmp(a->value.string, b->value.string) < 0;
+}
+
+
+static less_fn sort_comparison(object *proc, int all_numbers, int all_strings)
+{
+    if (all_numbers && is_primitive_proc(proc) &&
+            proc->value.primitive_proc == num_lt_proc) {
+        return less_numbers;
+    } else if (all_strings && is_primitive_proc(proc) &&
+            proc->value.primitive_proc == string_lt_proc) {
+        return less_strings;
+    }
+    return less_apply;
+}
+
+
+/* Merges the sorted lists a and b. Elements of a come first among equals.
+ */
+static object *merge_lists(object *a, object *b, less_fn less, object *proc)
+{
+    object *result;
+    object **tail = &result;
+    while (!is_empty_list(a) && !is_empty_list(b)) {
+        if (less(proc, car(b), car(a))) {
+            *tail = b;
+            tail = &b->value.pair.cdr;
+            b = cdr(b);
+        } else {
+            *tail = a;
+            tail = &a->value.pair.cdr;
+            a = cdr(a);
+        }
+    }
+    *tail = is_empty_list(a) ? b : a;
+    return result;
+}
+
+
+/* Sorts a proper list in place. bins[i] holds a sorted run of 2^i pairs, or
+ * NULL, and each pair is carried into them like a binary counter. Runs in
+ * higher bins hold earlier elements, which keeps the merges stable.
+ */
+static object *sort_list(object *list, less_fn less, object *proc)
+{
+    object *bins[8 * sizeof(long)];
+    int top = 0;
+    int i;
+
+    while (!is_empty_list(list)) {
+        object *run = list;
+        list = cdr(list);
+        set_cdr(run, get_empty_list());
+
+        for (i = 0; i < top && bins[i] != NULL; i++) {
+            run = merge_lists(bins[i], run, less, proc);
+            bins[i] = NULL;
+        }
+        if (i == top) {
+            top++;
+        }
+        bins[i] = run;
+    }
+
+    object *result = get_empty_list();
+    for (i = 0; i < top; i++) {
+        if (bins[i] != NULL) {
+            result = merge_lists(bins[i], result, less, proc);
+        }
+    }
+    return result;
+}
+
+
+static inline void swap(object **v, long i, long j)
+{
+    object *tmp = v[i];
+    v[i] = v[j];
+    v[j] = tmp;
+}
+
+
+static void insertion_sort(object **v, long n, less_fn less, object *proc)
+{
+    for (long i = 1; i < n; i++) {
+        object *item = v[i];
+        long j = i;
+        while (j > 0 && less(proc, item, v[j - 1])) {
+            v[j] = v[j - 1];
+            j--;
+        }
+        v[j] = item;
+    }
+}
+
+
+static void sift_down(object **v, long root, long n, less_fn less,
+        object *proc)
+{
+    for (long child = 2 * root + 1; child < n; child = 2 * root + 1) {
+        if (child + 1 < n && less(proc, v[child], v[child + 1])) {
+            child++;
+        }
+        if (!less(proc, v[root], v[child])) {
+            return;
+        }
+        swap(v, root, child);
+        root = child;
+    }
+}
+
+
+static void heap_sort(object **v, long n, less_fn less, object *proc)
+{
+    for (long i = n / 2 - 1; i >= 0; i--) {
+        sift_down(v, i, n, less, proc);
+    }
+    for (long end = n - 1; end > 0; end--) {
+        swap(v, 0, end);
+        sift_down(v, 0, end, less, proc);
+    }
+}
+
+
+#define INSERTION_SORT_SIZE 16
+
+
+/* Sorts v with quicksort on a median of three pivot, recursing into the
+ * smaller partition and looping on the larger one. Bounds checks keep an
+ * inconsistent comparison procedure from running off the ends.
+ */
+static void introsort(object **v, long n, int depth, less_fn less,
+        object *proc)
+{
+    while (n > INSERTION_SORT_SIZE) {
+        if (depth-- == 0) {
+            heap_sort(v, n, less, proc);
+            return;
+        }
+
+        long mid = (n - 1) / 2;
+        if (less(proc, v[mid], v[0])) {
+            swap(v, mid, 0);
+        }
+        if (less(proc, v[n - 1], v[mid])) {
+            swap(v, n - 1, mid);
+            if (less(proc, v[mid], v[0])) {
+                swap(v, mid, 0);
+            }
+        }
+
+        object *pivot = v[mid];
+        long i = -1, j = n;
+        for (;;) {
+            do {
+                i++;
+            } while (i < n - 1 && less(proc, v[i], pivot));
+            do {
+                j--;
+            } while (j > 0 && less(proc, pivot, v[j]));
+            if (i >= j) {
+                break;
+            }
+            swap(v, i, j);
+        }
+
+        long split = j + 1;
+        if (split < n - split) {
+            introsort(v, split, depth, less, proc);
+            v += split;
+            n -= split;
+        } else {
+            introsort(v + split, n - split, depth, less, proc);
+            n = split;
+        }
+    }
+    insertion_sort(v, n, less, proc);
+}
+
+
+static void sort_vector(object *vector, less_fn less, object *proc)
+{
+    long n = vector->value.vector.length;
+    int depth = 0;
+    for (long m = n; m > 1; m >>= 1) {
+        depth += 2;
+    }
+    introsort(vector->value.vector.items, n, depth, less, proc);
+}
+
+
+/* Sorts seq, a list or vector, with the comparison procedure proc. If copy
+ * is true, seq is left alone and a sorted copy is returned.
+ */
+static object *sort(object *seq, object *proc, int copy, char const *name)
+{
+    if (!is_procedure(proc)) {
+        error("%s called with non-procedure argument", name);
+    }
+
+    int all_numbers = 1;
+    int all_strings = 1;
+    if (is_vector(seq)) {
+        for (long i = 0; i < seq->value.vector.length; i++) {
+            all_numbers = all_numbers && is_number(seq->value.vector.items[i]);
+            all_strings = all_strings && is_string(seq->value.vector.items[i]);
+        }
+        if (copy) {
+            object *v = make_vector(seq->value.vector.length, NULL);
+            memcpy(v->value.vector.items, seq->value.vector.items,
+                    (size_t)seq->value.vector.length * sizeof(object *));
+            seq = v;
+        }
+        sort_vector(seq, sort_comparison(proc, all_numbers, all_strings),
+                proc);
+        return seq;
+    }
+
+    object *l;
+    for (l = seq; is_pair(l); l = cdr(l)) {
+        all_numbers = all_numbers && is_number(car(l));
+        all_strings = all_strings && is_string(car(l));
+    }
+    if (!is_empty_list(l)) {
+        error("%s called with an argument that is not a list or vector",
+                name);
+    }
+    return sort_list(copy ? copy_list(seq) : seq,
+            sort_comparison(proc, all_numbers, all_strings), proc);
+}
+
+
+static object *sort_proc(object *arguments)
+{
+    require_exactly_two(arguments, "sort");
+    return sort(car(arguments), car(cdr(arguments)), 1, "sort");
+}
+
+
+static object *sort_bang_proc(object *arguments)
+{
+    require_exactly_two(arguments, "sort!");
+    return sort(car(arguments), car(cdr(arguments)), 0, "sort!");
+}
+
+
+/**** Type conversion ****/
+static object *char_to_integer_proc(object *arguments)
+{
+    require_exactly_one(arguments, "char->integer");
+    require_character(car(arguments), "char->integer");
+
+    char value = car(arguments)->value.character;
+    return make_number(value);
+}
+
+
+static object *integer_to_char_proc(object *arguments)
+{
+    require_exactly_one(arguments, "integer->char");
+    require_number(car(arguments), "integer->char");
+
+    long value = car(arguments)->value.number;
+    if (value > CHAR_MAX || value < CHAR_MIN) {
+        error("integer out of range for conversion to char");
+    }
+
+    return make_character((char) value);
+}
+
+
+static object *number_to_string_proc(object *arguments)
+{
+    require_exactly_one(arguments, "number->string");
+    require_number(car(arguments), "number->string");
+
+    long value = car(arguments)->value.number;
+    long num = value;
+    unsigned digits = 0;
+    if (num <= 0) {
+        digits += 1;
+        num *= -1;
+    }
+
+    while (num) {
+        num /= 10;
+        digits++;
+    }
+
+    char *buffer = GC_MALLOC(digits + 1);
+    if (buffer == NULL) {
+        error("unable to allocate string buffer:");
+    }
+    snprintf(buffer, digits + 1, "%ld", value);
+
+    return make_string(buffer);
+}
+
+
+static object *string_to_number_proc(object *arguments)
+{
+    require_exactly_one(arguments, "string->number");
+    require_string(car(arguments), "string->number");
+
+    char const *s = car(arguments)->value.string;
+    char *end;
+    errno = 0;
+    long num = strtol(s, &end, 0);
+
+    if (end != (s + strlen(s))) {
+        error("string->number argument does not look like a number");
+    } else if (errno) {
+        error("unable to convert string to number:");
+    }
+
+    return make_number(num);
+}
+
+
+static object *symbol_to_string_proc(object *arguments)
+{
+    require_exactly_one(arguments, "symbol->string");
+    require_symbol(car(arguments), "symbol->string");
+
+    char const *sym = car(arguments)->value.symbol;
+    char *str = GC_MALLOC(strlen(sym) + 1);
+    if (str == NULL) {
+        error("unable to allocate string buffer:");
+    }
+    strcpy(str, sym);
+    return make_string(str);
+}
+
+
+static object *string_to_symbol_proc(object *arguments)
+{
+    /* This procedure can create a symbol that contains invalid characters. */
+    require_exactly_one(arguments, "string->symbol");
+    require_string(car(arguments), "string->symbol");
+
+    char const *str = car(arguments)->value.string;
+    char *sym = GC_MALLOC(strlen(str) + 1);
+    if (sym == NULL) {
+        error("unable to allocate symbol buffer:");
+    }
+    strcpy(sym, str);
+    return make_symbol(sym);
+}
+
+
+/**** Input/Output ****/
+static object *current_input_port_proc(object *arguments)
+{
+    require_zero(arguments, "current-input-port");
+    return get_input_port();
+}
+
+
+static object *current_output_port_proc(object *arguments)
+{
+    require_zero(arguments, "current-output-port");
+    return get_output_port();
+}
+
+
+static object *open_input_file_proc(object *arguments)
+{
+    require_exactly_one(arguments, "open-input-file");
+    require_string(car(arguments), "open-input-file");
+
+    return make_input_port(car(arguments)->value.string);
+}
+
+
+static object *open_output_file_proc(object *arguments)
+{
+    require_exactly_one(arguments, "open-output-file");
+    require_string(car(arguments), "open-output-file");
+
+    return make_output_port(car(arguments)->value.string);
+}
+
+
+static object *open_input_string_proc(object *arguments)
+{
+    require_exactly_one(arguments, "open-input-string");
+    require_string(car(arguments), "open-input-string");
+
+    return make_input_string_port(car(arguments)->value.string);
+}
+
+
+static object *open_output_string_proc(object *arguments)
+{
+    require_zero(arguments, "open-output-string");
+    return make_output_string_port();
+}
+
+
+static object *get_output_string_proc(object *arguments)
+{
+    require_exactly_one(arguments, "get-output-string");
+    if (!is_output_port(car(arguments)) || !is_string_port(car(arguments))) {
+        error("get-output-string called with non-string-port argument");
+    }
+
+    return make_string(get_output_string(car(arguments)));
+}
+
+
+static object *open_input_pipe_proc(object *arguments)
+{
+    require_exactly_one(arguments, "open-input-pipe");
+    require_string(car(arguments), "open-input-pipe");
+
+    return make_pipe_port(car(arguments)->value.string, 0);
+}
+
+
+static object *open_output_pipe_proc(object *arguments)
+{
+    require_exactly_one(arguments, "open-output-pipe");
+    require_string(car(arguments), "open-output-pipe");
+
+    return make_pipe_port(car(arguments)->value.string, 1);
+}
+
+
+/* Runs a program with string arguments, without a shell, and returns a pair
+ * of its exit status and an input port on its output.
+ */
+static object *run_process_proc(object *arguments)
+{
+    require_at_least_one(arguments, "run-process");
+
+    size_t count = 0;
+    for (object *rest = arguments; !is_empty_list(rest); rest = cdr(rest)) {
+        require_string(car(rest), "run-process");
+        count++;
+    }
+
+    char const **argv = GC_MALLOC((count + 1) * sizeof(char const *));
+    if (argv == NULL) {
+        error("unable to allocate argument vector:");
+    }
+    count = 0;
+    for (object *rest = arguments; !is_empty_list(rest); rest = cdr(rest)) {
+        argv[count++] = car(rest)->value.string;
+    }
+    argv[count] = NULL;
+
+    long status;
+    object *port = make_process_port(argv, &status);
+    return cons(make_number(status), port);
+}
+
+
+static object *close_input_port_proc(object *arguments)
+{
+    require_exactly_one(arguments, "close-input-file");
+    require_input_port(car(arguments), "close-input-file");
+
+    close_port(car(arguments));
+    return lookup_symbol("ok");
+}
+
+
+static object *close_output_port_proc(object *arguments)
+{
+    require_exactly_one(arguments, "close-output-port");
+    require_output_port(car(arguments), "close-output-port");
+
+    close_port(car(arguments));
+    return lookup_symbol("ok");
+}
+
+
+static object *read_proc(object *arguments)
+{
+    require_at_most_one(arguments, "read");
+
+    if (is_empty_list(arguments)) {
+        return bs_read(get_standard_input_port());
+    } else {
+        require_input_port(car(arguments), "read");
+        return bs_read(car(arguments));
+    }
+}
+
+
+static object *read_char_proc(object *arguments)
+{
+    require_at_most_one(arguments, "read-char");
+
+    int c;
+    if (is_empty_list(arguments)) {
+        c = read_char(get_standard_input_port());
+    } else {
+        require_input_port(car(arguments), "read-char");
+        c = read_char(car(arguments));
+    }
+
+    if (c == EOF) {
+        return get_end_of_file();
+    } else {
+        return make_character((char)c);
+    }
+}
+
+
+static object *peek_char_proc(object *arguments)
+{
+    require_at_most_one(arguments, "peek-char");
+
+    int c;
+    if (is_empty_list(arguments)) {
+        c = peek_char(get_standard_input_port());
+    } else {
+        require_input_port(car(arguments), "peek-char");
+        c = peek_char(car(arguments));
+    }
+
+    if (c == EOF) {
+        return get_end_of_file();
+    } else {
+        return make_character((char)c);
+    }
+}
+
+
+/* Returns the optional input port in rest, or standard input. The port is
+ * passed along rather than swapped in as the current port.
+ */
+static object *input_port_argument(object *rest, char const *name)
+{
+    if (is_empty_list(rest)) {
+        return get_standard_input_port();
+    } else if (!is_empty_list(cdr(rest))) {
+        error("%s called with too many arguments", name);
+    } else if (!is_input_port(car(rest))) {
+        error("%s called with non-input-port argument", name);
+    }
+    return car(rest);
+}
+
+
+/* Returns the optional output port in rest, or the current output port.
+ */
+static object *output_port_argument(object *rest, char const *name)
+{
+    if (is_empty_list(rest)) {
+        return get_output_port();
+    } else if (!is_empty_list(cdr(rest))) {
+        error("%s called with too many arguments", name);
+    } else if (!is_output_port(car(rest))) {
+        error("%s called with non-output-port argument", name);
+    }
+    return car(rest);
+}
+
+
+static object *read_line_proc(object *arguments)
+{
+    object *port = input_port_argument(arguments, "read-line");
+
+    char *line;
+    long len = read_line(port, &line);
+    if (len < 0) {
+        return get_end_of_file();
+    }
+
+    size_t end = strlen(line);
+    if (end > 0 && line[end - 1] == '\n') {
+        line[end - 1] = '\0';
+    }
+    return make_string(line);
+}
+
+
+static object *read_string_proc(object *arguments)
+{
+    require_at_least_one(arguments, "read-string");
+    require_number(car(arguments), "read-string");
+    object *port = input_port_argument(cdr(arguments), "read-string");
+
+    long k = car(arguments)->value.number;
+    if (k < 0) {
+        error("read-string called with a negative length");
+    }
+
+    char *buf = GC_MALLOC_ATOMIC((size_t)k + 1);
+    if (buf == NULL) {
+        error("unable to allocate string buffer:");
+    }
+    size_t len = read_bytes(port, buf, (size_t)k);
+    if (len == 0 && k > 0) {
+        return get_end_of_file();
+    }
+    buf[len] = '\0';
+    return make_string(buf);
+}
+
+
+static object *char_ready_proc(object *arguments)
+{
+    return get_boolean(char_ready(input_port_argument(arguments,
+                    "char-ready?")));
+}
+
+
+static object *write_string_proc(object *arguments)
+{
+    require_at_least_one(arguments, "write-string");
+    require_string(car(arguments), "write-string");
+    object *port = output_port_argument(cdr(arguments), "write-string");
+
+    char const *s = car(arguments)->value.string;
+    write_port_bytes(port, s, strlen(s));
+    return lookup_symbol("ok");
+}
+
+
+static object *write_proc(object *arguments)
+{
+    require_one_or_two(arguments, "write");
+
+    if (is_empty_list(cdr(arguments))) {
+        bs_write(car(arguments));
+    } else {
+        require_output_port(car(cdr(arguments)), "write");
+        object *prev_port = get_output_port();
+        set_output_port(car(cdr(arguments)));
+        bs_write(car(arguments));
+        set_output_port(prev_port);
+    }
+
+    return lookup_symbol("ok");
+}
+
+
+static object *write_shared_proc(object *arguments)
+{
+    require_one_or_two(arguments, "write-shared");
+
+    if (is_empty_list(cdr(arguments))) {
+        bs_write_shared(car(arguments));
+    } else {
+        require_output_port(car(cdr(arguments)), "write-shared");
+        object *prev_port = get_output_port();
+        set_output_port(car(cdr(arguments)));
+        bs_write_shared(car(arguments));
+        set_output_port(prev_port);
+    }
+
+    return lookup_symbol("ok");
+}
+
+
+static object *write_char_proc(object *arguments)
+{
+    require_one_or_two(arguments, "write-char");
     require_character(car(arguments), "write-char");
 
     if (is_empty_list(cdr(arguments))) {
-        write_output("%c", car(arguments)->value.character);
+        write_output_char(car(arguments)->value.character);
     } else {
         require_output_port(car(cdr(arguments)), "write-char");
         object *prev_port = get_output_port();
         set_output_port(car(cdr(arguments)));
-        write_output("%c", car(arguments)->value.character);
+        write_output_char(car(arguments)->value.character);
         set_output_port(prev_port);
     }
 
@@ -734,6 +2166,87 @@ static object *display_proc(object *arguments)
 }
 
 
+static object *fasl_write_proc(object *arguments)
+{
+    require_one_or_two(arguments, "fasl-write");
+
+    if (is_empty_list(cdr(arguments))) {
+        fasl_write(car(arguments));
+    } else {
+        require_output_port(car(cdr(arguments)), "fasl-write");
+        object *prev_port = get_output_port();
+        set_output_port(car(cdr(arguments)));
+        fasl_write(car(arguments));
+        set_output_port(prev_port);
+    }
+
+    return lookup_symbol("ok");
+}
+
+
+static object *fasl_read_proc(object *arguments)
+{
+    require_at_most_one(arguments, "fasl-read");
+
+    if (is_empty_list(arguments)) {
+        return fasl_read(get_standard_input_port());
+    } else {
+        require_input_port(car(arguments), "fasl-read");
+        return fasl_read(car(arguments));
+    }
+}
+
+
+static object *csv_read_row_proc(object *arguments)
+{
+    return csv_read_row(input_port_argument(arguments, "csv-read-row"));
+}
+
+
+static object *csv_write_row_proc(object *arguments)
+{
+    require_at_least_one(arguments, "csv-write-row");
+    if (!is_vector(car(arguments))) {
+        require_list(car(arguments), "csv-write-row");
+    }
+    object *port = output_port_argument(cdr(arguments), "csv-write-row");
+
+    csv_write_row(car(arguments), port);
+    return lookup_symbol("ok");
+}
+
+
+static object *json_read_proc(object *arguments)
+{
+    return json_read(input_port_argument(arguments, "json-read"));
+}
+
+
+static object *json_write_proc(object *arguments)
+{
+    require_at_least_one(arguments, "json-write");
+    object *port = output_port_argument(cdr(arguments), "json-write");
+
+    json_write(car(arguments), port);
+    return lookup_symbol("ok");
+}
+
+
+static object *flush_output_port_proc(object *arguments)
+{
+    require_at_most_one(arguments, "flush-output-port");
+
+    if (is_empty_list(arguments)) {
+        flush_port(get_output_port());
+    } else {
+        require_output_port(car(arguments), "flush-output-port");
+        flush_port(car(arguments));
+    }
+
+    return lookup_symbol("ok");
+}
+
+
 static object *stdin_port_proc(object *arguments)
 {
     require_zero(arguments, "stdin-port");
@@ -754,9 +2267,6 @@ static object *load_proc(object *arguments)
     require_string(car(arguments), "load");
 
     char const *src_file = car(arguments)->value.string;
-    object *input_port = make_input_port(src_file);
-    object *prev_port = get_input_port();
-    set_input_port(input_port);
 
     object *env;
     if (!is_empty_list(cdr(arguments))) {
@@ -766,37 +2276,144 @@ static object *load_proc(object *arguments)
     }
 
     object *result;
-    object *obj = bs_read();
+    object *obj;
+
+    // Forms are taken from the file's cache if it is up to date, so that
+    // unchanged files are never lexed or read.
+    object *key;
+    object *cached = read_load_cache(src_file, &key);
+    if (cached != NULL) {
+        for (; !is_empty_list(cached); cached = cdr(cached)) {
+            result = bs_eval(car(cached), env);
+        }
+        return result;
+    }
+
+    // Otherwise the forms are recorded as they are read, before evaluation
+    // has a chance to modify them, and saved as the new cache afterward.
+    object *input_port = make_input_port(src_file);
+    object *forms = key == NULL ? NULL : make_output_string_port();
+
+    obj = bs_read(input_port);
     while (!is_end_of_file(obj)) {
+        if (forms != NULL) {
+            object *prev_port = get_output_port();
+            set_output_port(forms);
+            fasl_write(obj);
+            set_output_port(prev_port);
+        }
         result = bs_eval(obj, env);
-        obj = bs_read();
+        obj = bs_read(input_port);
     }
 
-    set_input_port(prev_port);
     close_port(input_port);
+    if (forms != NULL) {
+        save_load_cache(src_file, key, forms);
+    }
 
     return result;
 }
 
 
-static object *error_proc(object *arguments)
+/**** Errors ****/
+/* Reports something that was raised but not caught, and exits.
+ */
+static void uncaught(object *obj)
 {
+    set_output_port(get_error_port());
     write_error("ERROR");
-    if (!is_empty_list(arguments))
-    {
-        write_error(": ");
-        set_output_port(get_error_port());
-        while (!is_empty_list(arguments)) {
-            display(car(arguments));
+    if (is_error_object(obj)) {
+        object *message = obj->value.error_object.message;
+        if (!is_string(message) || message->value.string[0] != '\0') {
+            write_error(": ");
+            display(message);
+            write_error(" ");
+        }
+        for (object *rest = obj->value.error_object.irritants;
+                !is_empty_list(rest); rest = cdr(rest)) {
+            display(car(rest));
             write_error(" ");
-            arguments = cdr(arguments);
         }
+    } else {
+        write_error(": uncaught exception: ");
+        bs_write(obj);
     }
     write_error("\n");
     exit(1);
 }
 
 
+static object *error_proc(object *arguments)
+{
+    object *error_object;
+    if (is_empty_list(arguments)) {
+        error_object = make_error_object(make_string(""), arguments);
+    } else {
+        error_object = make_error_object(car(arguments), cdr(arguments));
+    }
+    raise_object(error_object);
+    uncaught(error_object);
+    return NULL;
+}
+
+
+object *raise_proc(object *arguments)
+{
+    require_exactly_one(arguments, "raise");
+
+    raise_object(car(arguments));
+    uncaught(car(arguments));
+    return NULL;
+}
+
+
+/* Calls thunk. If it raises something, that is passed to handler instead,
+ * after control has left thunk, and handler's result is returned.
+ */
+static object *with_exception_handler_proc(object *arguments)
+{
+    require_exactly_two(arguments, "with-exception-handler");
+    require_procedure(car(arguments), "with-exception-handler");
+    require_procedure(car(cdr(arguments)), "with-exception-handler");
+
+    struct error_handler h;
+    push_error_handler(&h);
+    if (setjmp(h.jump) == 0) {
+        object *result = bs_apply(car(cdr(arguments)), get_empty_list());
+        pop_error_handler(&h);
+        return result;
+    }
+    return bs_apply(car(arguments), cons(h.condition, get_empty_list()));
+}
+
+
+static object *is_error_object_proc(object *arguments)
+{
+    require_exactly_one(arguments, "error-object?");
+    return get_boolean(is_error_object(car(arguments)));
+}
+
+
+static object *error_object_message_proc(object *arguments)
+{
+    require_exactly_one(arguments, "error-object-message");
+    if (!is_error_object(car(arguments))) {
+        error("error-object-message called with non-error-object argument");
+    }
+    return car(arguments)->value.error_object.message;
+}
+
+
+static object *error_object_irritants_proc(object *arguments)
+{
+    require_exactly_one(arguments, "error-object-irritants");
+    if (!is_error_object(car(arguments))) {
+        error("error-object-irritants called with non-error-object argument");
+    }
+    return car(arguments)->value.error_object.irritants;
+}
+
+
 /**** Eval/Apply ****/
 object *apply_proc(object *arguments)
 {
@@ -838,6 +2455,8 @@ static object *environment_proc(object *arguments)
 void init_primitives(object *env)
 {
     defproc("eq?", eq_proc, env);
+    defproc("eqv?", eqv_proc, env);
+    defproc("equal?", equal_proc, env);
     defproc("null?", is_null_proc, env);
     defproc("boolean?", is_boolean_proc, env);
     defproc("symbol?", is_symbol_proc, env);
@@ -865,7 +2484,74 @@ void init_primitives(object *env)
     defproc("set-cdr!", set_cdr_proc, env);
     defproc("length", length_proc, env);
     defproc("list", list_proc, env);
+    defproc("map", map_proc, env);
+    defproc("for-each", for_each_proc, env);
+    defproc("fold-left", fold_left_proc, env);
+    defproc("fold-right", fold_right_proc, env);
+    defproc("reverse", reverse_proc, env);
+    defproc("append", append_proc, env);
+    defproc("append!", append_bang_proc, env);
+    defproc("list-tail", list_tail_proc, env);
+    defproc("list-ref", list_ref_proc, env);
+    defproc("list-copy", list_copy_proc, env);
+    defproc("last-pair", last_pair_proc, env);
+    defproc("memq", memq_proc, env);
+    defproc("memv", memv_proc, env);
+    defproc("member", member_proc, env);
+    defproc("assq", assq_proc, env);
+    defproc("assv", assv_proc, env);
+    defproc("assoc", assoc_proc, env);
+    defproc("caar", caar_proc, env);
+    defproc("cadr", cadr_proc, env);
+    defproc("cdar", cdar_proc, env);
+    defproc("cddr", cddr_proc, env);
+    defproc("caaar", caaar_proc, env);
+    defproc("caadr", caadr_proc, env);
+    defproc("cadar", cadar_proc, env);
+    defproc("caddr", caddr_proc, env);
+    defproc("cdaar", cdaar_proc, env);
+    defproc("cdadr", cdadr_proc, env);
+    defproc("cddar", cddar_proc, env);
+    defproc("cdddr", cdddr_proc, env);
+    defproc("caaaar", caaaar_proc, env);
+    defproc("caaadr", caaadr_proc, env);
+    defproc("caadar", caadar_proc, env);
+    defproc("caaddr", caaddr_proc, env);
+    defproc("cadaar", cadaar_proc, env);
+    defproc("cadadr", cadadr_proc, env);
+    defproc("caddar", caddar_proc, env);
+    defproc("cadddr", cadddr_proc, env);
+    defproc("cdaaar", cdaaar_proc, env);
+    defproc("cdaadr", cdaadr_proc, env);
+    defproc("cdadar", cdadar_proc, env);
+    defproc("cdaddr", cdaddr_proc, env);
+    defproc("cddaar", cddaar_proc, env);
+    defproc("cddadr", cddadr_proc, env);
+    defproc("cdddar", cdddar_proc, env);
+    defproc("cddddr", cddddr_proc, env);
+    defproc("vector?", is_vector_proc, env);
+    defproc("make-vector", make_vector_proc, env);
+    defproc("vector", vector_proc, env);
+    defproc("vector-length", vector_length_proc, env);
+    defproc("vector-ref", vector_ref_proc, env);
+    defproc("vector-set!", vector_set_proc, env);
+    defproc("vector->list", vector_to_list_proc, env);
+    defproc("list->vector", list_to_vector_proc, env);
+    defproc("sort", sort_proc, env);
+    defproc("sort!", sort_bang_proc, env);
     defproc("string-append", string_append_proc, env);
+    defproc("string-length", string_length_proc, env);
+    defproc("string-ref", string_ref_proc, env);
+    defproc("substring", substring_proc, env);
+    defproc("string-index", string_index_proc, env);
+    defproc("string-search-forward", string_search_forward_proc, env);
+    defproc("string-split", string_split_proc, env);
+    defproc("string-join", string_join_proc, env);
+    defproc("string-upcase", string_upcase_proc, env);
+    defproc("string-downcase", string_downcase_proc, env);
+    defproc("string=?", string_eq_proc, env);
+    defproc("string<?", string_lt_proc, env);
+    defproc("string-hash", string_hash_proc, env);
     defproc("char->integer", char_to_integer_proc, env);
     defproc("integer->char", integer_to_char_proc, env);
     defproc("number->string", number_to_string_proc, env);
@@ -876,18 +2562,41 @@ void init_primitives(object *env)
     defproc("current-output-port", current_output_port_proc, env);
     defproc("open-input-file", open_input_file_proc, env);
     defproc("open-output-file", open_output_file_proc, env);
+    defproc("open-input-string", open_input_string_proc, env);
+    defproc("open-output-string", open_output_string_proc, env);
+    defproc("get-output-string", get_output_string_proc, env);
+    defproc("open-input-pipe", open_input_pipe_proc, env);
+    defproc("open-output-pipe", open_output_pipe_proc, env);
+    defproc("run-process", run_process_proc, env);
     defproc("close-input-port", close_input_port_proc, env);
     defproc("close-output-port", close_output_port_proc, env);
     defproc("read", read_proc, env);
     defproc("read-char", read_char_proc, env);
     defproc("peek-char", peek_char_proc, env);
+    defproc("read-line", read_line_proc, env);
+    defproc("read-string", read_string_proc, env);
+    defproc("char-ready?", char_ready_proc, env);
+    defproc("write-string", write_string_proc, env);
     defproc("write", write_proc, env);
+    defproc("write-shared", write_shared_proc, env);
     defproc("write-char", write_char_proc, env);
     defproc("display", display_proc, env);
+    defproc("fasl-write", fasl_write_proc, env);
+    defproc("fasl-read", fasl_read_proc, env);
+    defproc("csv-read-row", csv_read_row_proc, env);
+    defproc("csv-write-row", csv_write_row_proc, env);
+    defproc("json-read", json_read_proc, env);
+    defproc("json-write", json_write_proc, env);
+    defproc("flush-output-port", flush_output_port_proc, env);
     defproc("stdin-port", stdin_port_proc, env);
     defproc("stdout-port", stdout_port_proc, env);
     defproc("load", load_proc, env);
     defproc("error", error_proc, env);
+    defproc("raise", raise_proc, env);
+    defproc("with-exception-handler", with_exception_handler_proc, env);
+    defproc("error-object?", is_error_object_proc, env);
+    defproc("error-object-message", error_object_message_proc, env);
+    defproc("error-object-irritants", error_object_irritants_proc, env);
     defproc("apply", apply_proc, env);
     defproc("eval", eval_proc, env);
     defproc("interaction-environment", interaction_environment_proc, env);
@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include "gc.h"
 
 #include "error.h"
 #include "lexer.h"
@@ -13,69 +14,290 @@
 #include "read.h"
 #include "table.h"
 
-static object *read_pair(void);
+/* Datum labels, #n= and #n#, are scoped to the top-level datum being read.
+ * While the datum a label names is still being read, references to it
+ * resolve to a placeholder, which is patched once the datum is complete.
+ */
+struct label {
+    long n;
+    object *value;          // NULL while the datum is being read
+    object *placeholder;
+    int referenced;         // true if placeholder has been handed out
+};
+
+struct reader {
+    object *port;
+    struct label *labels;
+    size_t label_count, label_size;
+};
+
+static object *read_datum(struct reader *r);
+static object *read_list(struct reader *r);
+static object *read_vector(struct reader *r);
+static object *read_labelled(struct reader *r, long n);
+static object *read_reference(struct reader *r, long n);
+
+
+/* Reads the next datum from port. All of the reader's state, including
+ * lookahead, lives in the port's buffer, so any number of ports can be read
+ * in an interleaved fashion.
+ */
+object *bs_read(object *port)
+{
+    if (port_is_closed(port)) {
+        error("port is closed");
+    }
+    struct reader r = { port, NULL, 0, 0 };
+    return read_datum(&r);
+}
 
 
-object *bs_read(void)
+/* Reads one datum from port with a single character of lookahead, straight
+ * from the port buffer. Returns the end of file object if there are no more
+ * datums.
+ */
+static object *read_datum(struct reader *r)
 {
-    token *t = get_token();
-
-    while (t->type != TOK_DONE) {
-        switch (t->type) {
-            case TOK_NUMBER:
-                return make_number(t->value.number);
-            case TOK_BOOLEAN:
-                return get_boolean(t->value.boolean);
-            case TOK_CHARACTER:
-                return make_character(t->value.character);
-            case TOK_STRING:
-                return make_string(t->value.string);
-            case TOK_SYMBOL:
-                return make_symbol(t->value.string);
-            case TOK_LPAREN:
-                return read_pair();
-            case TOK_QUOTE:
-                return cons(lookup_symbol("quote"),
-                        cons(bs_read(), get_empty_list()));
-            case TOK_RPAREN:
-                error("unexpected closing parenthesis");
-            case TOK_DOT:
+    object *port = r->port;
+    object *obj;
+    int c = lex_next_char(port);
+    long n;
+
+    switch (c) {
+        case EOF:
+            return get_end_of_file();
+        case '(':
+            port_advance(port, 1);
+            return read_list(r);
+        case ')':
+            port_advance(port, 1);
+            error("unexpected closing parenthesis");
+        case '\'':
+            port_advance(port, 1);
+            obj = read_datum(r);
+            if (is_end_of_file(obj)) {
+                error("end of file after quote");
+            }
+            return cons(lookup_symbol("quote"), cons(obj, get_empty_list()));
+        case '#':
+            c = lex_label(port, &n);
+            if (c == '=') {
+                return read_labelled(r, n);
+            } else if (c == '#') {
+                return read_reference(r, n);
+            } else if (port_lookahead(port, 1) == '(') {
+                port_advance(port, 2);
+                return read_vector(r);
+            }
+            // fall through
+        default:
+            obj = lex_atom(port);
+            if (obj == NULL) {
                 error("dot outside of pair");
-            default:
-                error("unknown token type %d", t->type);
+            }
+            return obj;
+    }
+}
+
+
+/* Reads the rest of a list whose opening parenthesis has been consumed.
+ * Elements are appended through a tail pointer, so only nesting uses the C
+ * stack, not the length of the list.
+ */
+static object *read_list(struct reader *r)
+{
+    object *port = r->port;
+    object *head = get_empty_list();
+    object *tail = NULL;
+
+    for (;;) {
+        int c = lex_next_char(port);
+        if (c == EOF) {
+            error("end of file inside a list");
+        } else if (c == ')') {
+            port_advance(port, 1);
+            return head;
+        }
+
+        object *obj;
+        if (c == '.') {
+            obj = lex_atom(port);
+            if (obj == NULL) {
+                if (tail == NULL) {
+                    error("dot at the start of a list");
+                }
+                obj = read_datum(r);
+                if (is_end_of_file(obj)) {
+                    error("end of file inside a list");
+                }
+                set_cdr(tail, obj);
+
+                if (lex_next_char(port) != ')') {
+                    error("pair is missing a closing parenthesis");
+                }
+                port_advance(port, 1);
+                return head;
+            }
+        } else {
+            obj = read_datum(r);
+        }
+
+        object *pair = cons(obj, get_empty_list());
+        if (tail == NULL) {
+            head = pair;
+        } else {
+            set_cdr(tail, pair);
         }
-        t = get_token();
+        tail = pair;
+    }
+}
+
+
+/* Reads the rest of a vector whose opening #( has been consumed.
+ */
+static object *read_vector(struct reader *r)
+{
+    object *list = read_list(r);
+    if (!is_list(list)) {
+        error("dot inside a vector");
     }
 
-    return get_end_of_file();
+    long length = 0;
+    for (object *l = list; !is_empty_list(l); l = cdr(l)) {
+        length++;
+    }
+    object *v = make_vector(length, get_empty_list());
+    for (long i = 0; i < length; i++) {
+        v->value.vector.items[i] = car(list);
+        list = cdr(list);
+    }
+    return v;
 }
 
 
-static object *read_pair(void)
+static struct label *find_label(struct reader *r, long n)
 {
-    token *t = get_token();
-    if (t->type == TOK_RPAREN) {
-        return get_empty_list();
+    for (size_t i = 0; i < r->label_count; i++) {
+        if (r->labels[i].n == n) {
+            return &r->labels[i];
+        }
+    }
+    return NULL;
+}
+
+
+/* Replaces every reference to placeholder in the datum obj with value. The
+ * datum may already be cyclic, so pairs and vectors are visited at most once,
+ * and an explicit stack is used instead of recursion.
+ */
+static void patch_placeholder(object *obj, object *placeholder, object *value)
+{
+    struct object_table *seen = make_object_table();
+    size_t count = 0, size = 64;
+    object **stack = GC_MALLOC(size * sizeof(object *));
+    if (stack == NULL) {
+        error("unable to allocate reader stack:");
     }
 
-    push_back_token(t);
+    stack[count++] = obj;
+    while (count > 0) {
+        obj = stack[--count];
+        if ((!is_pair(obj) && !is_vector(obj)) ||
+                object_table_get(seen, obj)) {
+            continue;
+        }
+        object_table_put(seen, obj, 1);
 
-    object *car_obj = bs_read();
-    object *cdr_obj;
+        if (is_vector(obj)) {
+            for (long i = 0; i < obj->value.vector.length; i++) {
+                object *item = obj->value.vector.items[i];
+                if (item == placeholder) {
+                    obj->value.vector.items[i] = value;
+                } else if (is_pair(item) || is_vector(item)) {
+                    if (count == size) {
+                        size *= 2;
+                        stack = GC_REALLOC(stack, size * sizeof(object *));
+                        if (stack == NULL) {
+                            error("unable to grow reader stack:");
+                        }
+                    }
+                    stack[count++] = item;
+                }
+            }
+            continue;
+        }
 
-    t = get_token();
-    if (t->type == TOK_DOT) {
-        cdr_obj = bs_read();
+        if (car(obj) == placeholder) {
+            set_car(obj, value);
+        }
+        if (cdr(obj) == placeholder) {
+            set_cdr(obj, value);
+        }
 
-        t = get_token();
-        if (t->type != TOK_RPAREN) {
-            error("pair is missing a closing parenthesis");
+        if (count + 2 > size) {
+            size *= 2;
+            stack = GC_REALLOC(stack, size * sizeof(object *));
+            if (stack == NULL) {
+                error("unable to grow reader stack:");
+            }
         }
-        return cons(car_obj, cdr_obj);
-    } else {
-        push_back_token(t);
-        cdr_obj = read_pair();
-        return cons(car_obj, cdr_obj);
+        stack[count++] = cdr(obj);
+        stack[count++] = car(obj);
     }
 }
 
+
+/* Reads the datum after the label #n=.
+ */
+static object *read_labelled(struct reader *r, long n)
+{
+    if (find_label(r, n) != NULL) {
+        error("duplicate datum label");
+    }
+
+    if (r->label_count == r->label_size) {
+        r->label_size = r->label_size == 0 ? 8 : r->label_size * 2;
+        r->labels = GC_REALLOC(r->labels, r->label_size * sizeof(struct label));
+        if (r->labels == NULL) {
+            error("unable to grow label table:");
+        }
+    }
+    size_t index = r->label_count++;
+    r->labels[index].n = n;
+    r->labels[index].value = NULL;
+    r->labels[index].placeholder = cons(get_empty_list(), get_empty_list());
+    r->labels[index].referenced = 0;
+
+    object *obj = read_datum(r);
+    if (is_end_of_file(obj)) {
+        error("end of file after datum label");
+    }
+
+    // The label table may have moved while the datum was read.
+    struct label *label = &r->labels[index];
+    if (obj == label->placeholder) {
+        error("datum label refers only to itself");
+    }
+    label->value = obj;
+    if (label->referenced) {
+        patch_placeholder(obj, label->placeholder, obj);
+    }
+    return obj;
+}
+
+
+/* Resolves the reference #n#.
+ */
+static object *read_reference(struct reader *r, long n)
+{
+    struct label *label = find_label(r, n);
+    if (label == NULL) {
+        error("reference to undefined datum label");
+    }
+
+    if (label->value != NULL) {
+        return label->value;
+    }
+    label->referenced = 1;
+    return label->placeholder;
+}
@@ -11,7 +11,7 @@
 
 #include "object.h"
 
-object *bs_read(void);
+object *bs_read(object *port);
 
 #define READ_H
 
@@ -0,0 +1,161 @@
+/* Evaluation server on a Unix domain socket.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "environment.h"
+#include "error.h"
+#include "eval.h"
+#include "object.h"
+#include "port.h"
+#include "read.h"
+#include "server.h"
+#include "write.h"
+
+/* The server accepts connections on a socket and forks a child for each
+ * one. The child starts with the warm global environment of the server, so
+ * nothing is initialized or loaded again, and nothing it does changes the
+ * server.
+ *
+ * A client sends any number of requests, each a datum to evaluate. Each is
+ * evaluated in a new environment that extends the global one, and answered
+ * on a line of its own with one of these:
+ *
+ *     (ok value)                       the request's value
+ *     (error message irritant...)      it raised an error object
+ *     (raise obj)                      it raised something else
+ *
+ * Anything a request writes to the current output port goes to the client
+ * ahead of its reply. A request that can't be read is answered with an
+ * error, and then the connection is closed, since there is no telling where
+ * the next request would start.
+ */
+
+
+static void write_reply(object *tag, object *contents)
+{
+    write_output_char('(');
+    bs_write(tag);
+    for (; !is_empty_list(contents); contents = cdr(contents)) {
+        write_output_char(' ');
+        bs_write(car(contents));
+    }
+    write_output_string(")\n");
+}
+
+
+static void serve_connection(int fd)
+{
+    object *in = make_fd_port(fd, 0);
+    int out_fd = dup(fd);
+    if (out_fd < 0) {
+        error("unable to duplicate socket:");
+    }
+    object *out = make_fd_port(out_fd, 1);
+    set_output_port(out);
+
+    for (;;) {
+        struct error_handler h;
+        volatile int reading = 1;
+        push_error_handler(&h);
+        if (setjmp(h.jump) == 0) {
+            object *request = bs_read(in);
+            reading = 0;
+            if (is_end_of_file(request)) {
+                pop_error_handler(&h);
+                break;
+            }
+            object *env = extend_environment(get_empty_list(),
+                    get_empty_list(), get_global_environment());
+            object *value = bs_eval(request, env);
+            pop_error_handler(&h);
+            write_reply(make_symbol("ok"), cons(value, get_empty_list()));
+        } else if (is_error_object(h.condition)) {
+            write_reply(make_symbol("error"),
+                    cons(h.condition->value.error_object.message,
+                        h.condition->value.error_object.irritants));
+        } else {
+            write_reply(make_symbol("raise"),
+                    cons(h.condition, get_empty_list()));
+        }
+        flush_port(out);
+        if (reading) {
+            break;
+        }
+    }
+
+    close_port(in);
+    close_port(out);
+}
+
+
+/* Serves requests on a socket at path until bs is killed. A file already
+ * at path is replaced.
+ */
+void serve(char const *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        error("socket path is too long: %s", path);
+    }
+    strcpy(addr.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        error("unable to create socket:");
+    }
+    fcntl(listener, F_SETFD, FD_CLOEXEC);
+    unlink(path);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        error("unable to bind %s:", path);
+    }
+    if (listen(listener, SOMAXCONN) < 0) {
+        error("unable to listen on %s:", path);
+    }
+
+    // Children are never waited for, so don't let them become zombies.
+    signal(SIGCHLD, SIG_IGN);
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            error("unable to accept connection:");
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        // Buffered output would otherwise be written by both processes.
+        flush_output_ports();
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listener);
+            forget_output_ports();
+            signal(SIGCHLD, SIG_DFL);
+            signal(SIGPIPE, SIG_IGN);
+            serve_connection(fd);
+            exit(0);
+        } else if (pid < 0) {
+            warn("unable to fork for a connection");
+        }
+        close(fd);
+    }
+}
+
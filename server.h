@@ -0,0 +1,13 @@
+/* Evaluation server on a Unix domain socket.
+ *
+ * Copyright (c) 2010 James E. Ingram
+ * See the LICENSE file for terms of use.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+void serve(char const *path);
+
+#endif
+
@@ -1,4 +1,4 @@
-/* Symbol table.
+/* Symbol and object tables.
  *
  * Copyright (c) 2010 James E. Ingram
  * See the LICENSE file for terms of use.
@@ -76,3 +76,100 @@ object *lookup_symbol(char const *name)
     return NULL;
 }
 
+
+/* Object tables map objects, by identity, to longs. They are open addressed
+ * with linear probing and are used wherever a traversal needs to remember the
+ * objects it has seen.
+ */
+struct object_table {
+    object **keys;
+    long *values;
+    unsigned long size;     // always a power of two
+    unsigned long count;
+};
+
+
+#define OBJECT_TABLE_SIZE 64
+
+
+static unsigned long hash_object(object *key, unsigned long size)
+{
+    unsigned long h = (unsigned long)(size_t)key >> 4;
+    h *= 0x9e3779b97f4a7c15UL;
+    return (h >> 16) & (size - 1);
+}
+
+
+struct object_table *make_object_table(void)
+{
+    struct object_table *table = GC_MALLOC(sizeof(struct object_table));
+    if (table == NULL) {
+        error("unable to allocate object table:");
+    }
+
+    table->keys = GC_MALLOC(OBJECT_TABLE_SIZE * sizeof(object *));
+    table->values = GC_MALLOC_ATOMIC(OBJECT_TABLE_SIZE * sizeof(long));
+    if (table->keys == NULL || table->values == NULL) {
+        error("unable to allocate object table:");
+    }
+    table->size = OBJECT_TABLE_SIZE;
+    table->count = 0;
+
+    return table;
+}
+
+
+/* Returns the value stored for key, or 0 if there is none.
+ */
+long object_table_get(struct object_table *table, object *key)
+{
+    unsigned long i = hash_object(key, table->size);
+    while (table->keys[i] != NULL) {
+        if (table->keys[i] == key) {
+            return table->values[i];
+        }
+        i = (i + 1) & (table->size - 1);
+    }
+    return 0;
+}
+
+
+static void grow_object_table(struct object_table *table)
+{
+    object **keys = table->keys;
+    long *values = table->values;
+    unsigned long size = table->size;
+
+    table->size = size * 2;
+    table->keys = GC_MALLOC(table->size * sizeof(object *));
+    table->values = GC_MALLOC_ATOMIC(table->size * sizeof(long));
+    if (table->keys == NULL || table->values == NULL) {
+        error("unable to grow object table:");
+    }
+    table->count = 0;
+
+    for (unsigned long i = 0; i < size; i++) {
+        if (keys[i] != NULL) {
+            object_table_put(table, keys[i], values[i]);
+        }
+    }
+}
+
+
+void object_table_put(struct object_table *table, object *key, long value)
+{
+    if (2 * (table->count + 1) > table->size) {
+        grow_object_table(table);
+    }
+
+    unsigned long i = hash_object(key, table->size);
+    while (table->keys[i] != NULL && table->keys[i] != key) {
+        i = (i + 1) & (table->size - 1);
+    }
+
+    if (table->keys[i] == NULL) {
+        table->keys[i] = key;
+        table->count++;
+    }
+    table->values[i] = value;
+}
@@ -1,4 +1,4 @@
-/* Symbol table.
+/* Symbol and object tables.
  *
  * Copyright (c) 2010 James E. Ingram
  * See the LICENSE file for terms of use.
@@ -12,5 +12,11 @@
 object *insert_symbol(object *symbol);
 object *lookup_symbol(char const *name);
 
+struct object_table;
+
+struct object_table *make_object_table(void);
+long object_table_get(struct object_table *table, object *key);
+void object_table_put(struct object_table *table, object *key, long value);
+
 #endif
 
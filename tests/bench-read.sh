@@ -0,0 +1,41 @@
+#!/bin/bash
+# Reader microbenchmark. Builds a large corpus out of the Scheme sources in
+# the project, reads every datum in it with `read`, and reports how many
+# bytes per second were lexed and read.
+#
+# Usage: ./bench-read.sh [megabytes]
+#
+# The corpus is about 64 MB by default. Nothing in it is evaluated, so the
+# time is almost all spent in the lexer and reader.
+
+MB=${1:-64}
+CORPUS=corpus.scm
+DRIVER=bench-read.scm
+
+echo "Rebuilding bs (if needed)"
+pushd .. > /dev/null
+scons -s
+popd > /dev/null
+
+echo "Building a ${MB} MB corpus"
+: > $CORPUS
+while [ $(stat -c %s $CORPUS) -lt $((MB * 1024 * 1024)) ]; do
+    cat ../stdlib.scm tests.scm ../bsrepl.scm >> $CORPUS
+done
+
+cat > $DRIVER <<EOF
+(define port (open-input-file "$CORPUS"))
+(define (drain) (if (eof-object? (read port)) 'done (drain)))
+(drain)
+EOF
+
+echo "Reading"
+BYTES=$(stat -c %s $CORPUS)
+START=$(date +%s%N)
+../bs $DRIVER
+END=$(date +%s%N)
+
+NS=$((END - START))
+echo "$BYTES bytes in $((NS / 1000000)) ms:" \
+    "$((BYTES * 1000 / (NS / 1000) )) KB/s"
+rm $CORPUS $DRIVER
@@ -0,0 +1,72 @@
+#!/bin/bash
+# Server benchmark. Sends the same small request to `bs --serve` over a new
+# connection each time, over one persistent connection, and to a new bs
+# process each time, and reports requests per second and p99 latency for
+# each. The client is a short Python 3 script.
+#
+# Usage: ./bench-serve.sh [requests]
+
+N=${1:-1000}
+SOCKET=bench-serve.sock
+PRELUDE=bench-serve.scm
+
+echo "Rebuilding bs (if needed)"
+pushd .. > /dev/null
+scons -s
+popd > /dev/null
+
+cat > $PRELUDE <<SCM
+(define (square x) (* x x))
+SCM
+
+../bs --serve $SOCKET $PRELUDE &
+SERVER=$!
+while [ ! -S $SOCKET ]; do sleep 0.1; done
+
+python3 - $N $SOCKET $PRELUDE <<'PY'
+import socket, subprocess, sys, time
+
+n, path, prelude = int(sys.argv[1]), sys.argv[2], sys.argv[3]
+request = b'(square 12)\n'
+
+def report(name, times):
+    times.sort()
+    print('%-24s %8.0f req/s   p99 %7.3f ms' % (name,
+        len(times) / sum(times), times[int(len(times) * 0.99)] * 1000))
+
+def connect():
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(path)
+    return s, s.makefile('rb')
+
+times = []
+for _ in range(n):
+    start = time.perf_counter()
+    s, f = connect()
+    s.sendall(request)
+    f.readline()
+    s.close()
+    times.append(time.perf_counter() - start)
+report('connection per request', times)
+
+times = []
+s, f = connect()
+for _ in range(n):
+    start = time.perf_counter()
+    s.sendall(request)
+    f.readline()
+    times.append(time.perf_counter() - start)
+s.close()
+report('persistent connection', times)
+
+times = []
+for _ in range(n):
+    start = time.perf_counter()
+    subprocess.run(['../bs', '-p', '-e', '(load "%s") (square 12)' % prelude],
+            stdout=subprocess.DEVNULL)
+    times.append(time.perf_counter() - start)
+report('process per request', times)
+PY
+
+kill $SERVER
+rm -f $SOCKET $PRELUDE $PRELUDE.bsc
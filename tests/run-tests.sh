@@ -25,5 +25,6 @@ echo Running tests
 ../bs -p tests.scm > actual
 echo Comparing results
 diff -s --suppress-common-lines --width=80 -U 0 expected actual
-rm expected actual
+rm -f expected actual fasl.out cache.scm cache.scm.bsc cache.tmp pipe.out \
+    gzip.out.gz serve.sock batch1.scm batch2.scm batch3.scm
 
@@ -286,3 +286,234 @@ environment                             ; #<procedure>
 (append '() '(1 2 3))                   ; (1 2 3)
 (append '(2 4 6) '())                   ; (2 4 6)
 (call-with-input-file "./tests.scm" peek-char)  ; #\(
+(define p1 (open-input-file "./tests.scm"))     ; ok
+(define p2 (open-input-file "./tests.scm"))     ; ok
+(read p1)                               ; (load "../stdlib.scm")
+(read p2)                               ; (load "../stdlib.scm")
+(read p1)                               ; 0
+(read-char p2)                          ; #\space
+(read p1)                               ; 451
+(read p2)                               ; 0
+(define sp (open-input-string "(a b) 42 \"str\""))  ; ok
+(read sp)                               ; (a b)
+(read-char sp)                          ; #\space
+(peek-char sp)                          ; #\4
+(read sp)                               ; 42
+(read sp)                               ; "str"
+(eof-object? (read sp))                 ; #t
+(define op (open-output-string))        ; ok
+(write '(1 "two" #\3) op)               ; ok
+(display " and more" op)                ; ok
+(get-output-string op)                  ; "(1 \"two\" #\\3) and more"
+(define c (list 1 2 3))                 ; ok
+(set-cdr! (cdr (cdr c)) c)              ; ok
+c                                       ; #0=(1 2 3 . #0#)
+(define s (list 1 2))                   ; ok
+(list s s)                              ; ((1 2) (1 2))
+(define op2 (open-output-string))       ; ok
+(write-shared (list s s) op2)           ; ok
+(get-output-string op2)                 ; "(#0=(1 2) #0#)"
+'#0=(a b . #0#)                         ; #0=(a b . #0#)
+'#0=(#0# x)                             ; #0=(#0# x)
+(define r '#1=(x #1#))                  ; ok
+(eq? r (car (cdr r)))                   ; #t
+'(#0=(1) #0#)                           ; ((1) (1))
+'(1 #0=(2 #(3 #0#)))                     ; (1 #0=(2 #(3 #0#)))
+(define fo (open-output-file "fasl.out"))       ; ok
+(fasl-write '(1 -2 "three" #\4 #t () sym) fo)   ; ok
+(fasl-write c fo)                       ; ok
+(fasl-write (list s s) fo)              ; ok
+(fasl-write (list (string->symbol "") 'x) fo)   ; ok
+(close-output-port fo)                  ; ok
+(define fi (open-input-file "fasl.out"))        ; ok
+(fasl-read fi)                          ; (1 -2 "three" #\4 #t () sym)
+(fasl-read fi)                          ; #0=(1 2 3 . #0#)
+(define f3 (fasl-read fi))              ; ok
+(eq? (car f3) (car (cdr f3)))           ; #t
+(map symbol->string (fasl-read fi))     ; ("" "x")
+(eof-object? (fasl-read fi))            ; #t
+(guard (e (#t (error-object-message e))) (fasl-read (cdr (run-process "printf" "BSF\\001\\377\\377\\377\\377\\377\\377\\377\\377\\377\\001\\001\\200\\302\\327\\057"))))   ; "fasl record is truncated"
+(define cache-runs 0)                   ; ok
+(define lo (open-output-file "cache.scm"))   ; ok
+(write '(set! cache-runs (+ cache-runs 1)) lo)   ; ok
+(write '(+ 40 2) lo)                     ; ok
+(close-output-port lo)                  ; ok
+(load "cache.scm")                      ; 42
+(car (run-process "sh" "-c" "head -c 9 cache.scm.bsc > cache.tmp && mv cache.tmp cache.scm.bsc"))   ; 0
+(load "cache.scm")                      ; 42
+(car (run-process "sh" "-c" "head -c -3 cache.scm.bsc > cache.tmp && mv cache.tmp cache.scm.bsc"))   ; 0
+(load "cache.scm")                      ; 42
+(load "cache.scm")                      ; 42
+cache-runs                              ; 4
+(define lo (open-output-file "cache.scm.bsc"))   ; ok
+(write-string "garbage" lo)             ; ok
+(close-output-port lo)                  ; ok
+(load "cache.scm")                      ; 42
+(car (run-process "rm" "cache.scm" "cache.scm.bsc"))   ; 0
+(map + '(1 2 3) '(10 20 30 40))         ; (11 22 33)
+(map car '((a 1) (b 2)))                ; (a b)
+(fold-left cons '() '(1 2 3))           ; (((() . 1) . 2) . 3)
+(fold-right cons '() '(1 2 3))          ; (1 2 3)
+(fold-left + 0 '(1 2) '(10 20))         ; 33
+(reverse '(1 (2 3) 4))                  ; (4 (2 3) 1)
+(append '(1) '(2) '() '(3 4) 5)         ; (1 2 3 4 . 5)
+(append)                                ; ()
+(define a1 (list 1 2))                  ; ok
+(append! a1 '() (list 3) (list 4 5))    ; (1 2 3 4 5)
+a1                                      ; (1 2 3 4 5)
+(list-tail '(a b c d) 2)                ; (c d)
+(list-ref '(a b c d) 3)                 ; d
+(define lc (list-copy a1))              ; ok
+(eq? lc a1)                             ; #f
+lc                                      ; (1 2 3 4 5)
+(last-pair '(1 2 . 3))                  ; (2 . 3)
+(caddr '(1 2 3))                        ; 3
+(cdadr '(1 (2 3)))                      ; (3)
+(apply map list '((1 2) (3 4)))         ; ((1 3) (2 4))
+(define (build n l) (if (= n 0) l (build (- n 1) (cons n l))))  ; ok
+(length (fold-right cons '() (map + (build 200000 '()))))  ; 200000
+#(1 "two" #\3)                          ; #(1 "two" #\3)
+(define v (make-vector 3 0))            ; ok
+(vector-set! v 1 'x)                    ; ok
+v                                       ; #(0 x 0)
+(vector-ref v 1)                        ; x
+(vector-length (vector))                ; 0
+(vector? v)                             ; #t
+(vector->list (vector 1 2 3))           ; (1 2 3)
+(list->vector '(a (b) #(c)))            ; #(a (b) #(c))
+(vector-set! v 2 v)                     ; ok
+v                                       ; #0=#(0 x #0#)
+(sort '(3 1 2 5 4) <)                   ; (1 2 3 4 5)
+(sort (vector 9 -1 5 0 3) >)            ; #(9 5 3 0 -1)
+(define (car-a? x y) (and (eq? (car x) 'a) (eq? (car y) 'b)))    ; ok
+(sort '((b . 1) (a . 2) (b . 0) (a . 1)) car-a?)    ; ((a . 2) (a . 1) (b . 1) (b . 0))
+(define sv (vector 4 2 3 1))            ; ok
+(sort! sv <)                            ; #(1 2 3 4)
+sv                                      ; #(1 2 3 4)
+(equal? '(1 (2 #(3 "four")) . 5) (list 1 (list 2 (vector 3 "four")) 5))    ; #f
+(equal? '(1 (2 #(3 "four")) . 5) (cons 1 (cons (list 2 (vector 3 "four")) 5)))  ; #t
+(equal? "abc" "abd")                    ; #f
+(equal? #(1 2) #(1 2 3))                ; #f
+(eqv? 2 2)                              ; #t
+(eqv? '(1) '(1))                        ; #f
+(memq 'c '(a b c d))                    ; (c d)
+(memv 5 '(1 2 3))                       ; #f
+(member '(2) '((1) (2) (3)))            ; ((2) (3))
+(member 2 '(1 2 3) (lambda (x y) (< x y)))  ; (3)
+(assq 'b '((a 1) (b 2)))                ; (b 2)
+(assv 2 '((1 one) (2 two)))             ; (2 two)
+(assoc "b" '(("a" . 1) ("b" . 2)))      ; ("b" . 2)
+(assoc 'z '((a 1)))                     ; #f
+(string-length "hello")                 ; 5
+(string-ref "hello" 1)                  ; #\e
+(substring "hello world" 6)             ; "world"
+(substring "hello world" 0 5)           ; "hello"
+(string-index "a,b,c" #\,)              ; 1
+(string-index "a,b,c" #\, 2)            ; 3
+(string-index "abc" #\z)                ; #f
+(string-search-forward "lo w" "hello world" 0)  ; 3
+(string-search-forward "xyz" "hello world")     ; #f
+(string-split "a,b,,c" #\,)             ; ("a" "b" "" "c")
+(string-join '("a" "b" "c") ", ")       ; "a, b, c"
+(string-join '())                       ; ""
+(string-upcase "Hello")                 ; "HELLO"
+(string-downcase "Hello")               ; "hello"
+(string=? "abc" "abc" "abc")            ; #t
+(string<? "abc" "abd")                  ; #t
+(string<? "abc" "abc")                  ; #f
+(= (string-hash "abc") (string-hash (string-append "a" "bc")))  ; #t
+(string-hash "abc" 1)                   ; 0
+(sort '("pear" "apple" "fig") string<?) ; ("apple" "fig" "pear")
+(define lp (open-input-string "first line\nsecond\n\nlast"))   ; ok
+(char-ready? lp)                        ; #t
+(read-line lp)                          ; "first line"
+(read-string 3 lp)                      ; "sec"
+(read-line lp)                          ; "ond"
+(read-line lp)                          ; ""
+(read-line lp)                          ; "last"
+(eof-object? (read-line lp))            ; #t
+(eof-object? (read-string 2 lp))        ; #t
+(define wp (open-output-string))        ; ok
+(write-string "a \"quoted\" line" wp)   ; ok
+(get-output-string wp)                  ; "a \"quoted\" line"
+(define cp (open-input-string "a,b,c\n\"x, y\",\"say \"\"hi\"\"\",\n\"two\nlines\",2\n"))   ; ok
+(csv-read-row cp)                       ; #("a" "b" "c")
+(csv-read-row cp)                       ; #("x, y" "say \"hi\"" "")
+(csv-read-row cp)                       ; #("two\nlines" "2")
+(eof-object? (csv-read-row cp))         ; #t
+(define cw (open-output-string))        ; ok
+(csv-write-row '("plain" "a,b" "q\"q" 42) cw)   ; ok
+(csv-write-row (vector "" 'sym) cw)     ; ok
+(get-output-string cw)                  ; "plain,\"a,b\",\"q\"\"q\",42\n,sym\n"
+(define jp (open-input-string "{\"name\": \"bs\", \"tags\": [1, -2, true, null], \"nested\": {\"empty\": [], \"none\": {}}} \"caf\\u00e9\\n\""))   ; ok
+(define js (json-read jp))              ; ok
+js                                      ; ((name . "bs") (tags . #(1 -2 #t null)) (nested (empty . #()) (none)))
+(cdr (assq 'tags js))                   ; #(1 -2 #t null)
+(string-length (json-read jp))          ; 6
+(eof-object? (json-read jp))            ; #t
+(define jk (json-read (open-input-string "{\"Name\": 1}")))   ; ok
+(assq 'Name jk)                         ; #f
+(assq (string->symbol "Name") jk)       ; (Name . 1)
+(define (read-all-with reader p) (let ((v (guard (e (#t 'err)) (reader p)))) (if (eof-object? v) '() (cons v (read-all-with reader p)))))   ; ok
+(read-all-with json-read (open-input-string "{\"a\": tru} 5 [1 2] 1.5 \"\\q\" 7 \"open"))   ; (err err 5 err err err err 7 err)
+(guard (e (#t (error-object-message e))) (json-read (open-input-string "\"a\\u0000b\"")))   ; "json syntax error: strings can't contain a nul"
+(read-all-with csv-read-row (open-input-string "a,\"unterminated\nb"))   ; (err)
+(define jw (open-output-string))        ; ok
+(json-write js jw)                      ; ok
+(get-output-string jw)                  ; "{\"name\":\"bs\",\"tags\":[1,-2,true,null],\"nested\":{\"empty\":[],\"none\":{}}}"
+(define pp (open-input-pipe "echo one && echo two"))   ; ok
+(read-line pp)                          ; "one"
+(read pp)                               ; two
+(close-input-port pp)                   ; ok
+(define rp (run-process "printf" "%s,%s" "a b" "c"))   ; ok
+(car rp)                                ; 0
+(read-line (cdr rp))                    ; "a b,c"
+(car (run-process "sh" "-c" "exit 3"))  ; 3
+(define op (open-output-pipe "cat > pipe.out"))   ; ok
+(write-string "piped" op)               ; ok
+(close-output-port op)                  ; ok
+(read-line (open-input-file "pipe.out"))   ; "piped"
+(define gz (open-output-file "gzip.out.gz"))   ; ok
+(write '(compressed "data" #(1 2 3)) gz)   ; ok
+(close-output-port gz)                  ; ok
+(read (open-input-file "gzip.out.gz"))  ; (compressed "data" #(1 2 3))
+(read-line (open-input-pipe "gzip -dc gzip.out.gz && rm gzip.out.gz"))   ; "(compressed \"data\" #(1 2 3))"
+(car (run-process "sh" "-c" ": > gzip.out.gz"))   ; 0
+(eof-object? (read-char (open-input-file "gzip.out.gz")))   ; #t
+(car (run-process "sh" "-c" "printf x | gzip | head -c 10 > gzip.out.gz"))   ; 0
+(eof-object? (read-char (open-input-file "gzip.out.gz")))   ; #t
+(car (run-process "rm" "gzip.out.gz"))  ; 0
+(define (shell-line cmd) (read-line (cdr (run-process "sh" "-c" cmd))))   ; ok
+(define echo-lines "../bs -e '(lambda (line) (display line) (newline))' -n")   ; ok
+(equal? (shell-line "seq 100000 | cksum") (shell-line (string-append "seq 100000 | " echo-lines " | cksum")))   ; #t
+(equal? (shell-line "seq 100000 | cksum") (shell-line (string-append "seq 100000 | " echo-lines " --read-ahead | cksum")))   ; #t
+(guard (e (#t (error-object-message e))) (error "bad thing" 1 2))   ; "bad thing"
+(error-object-irritants (guard (e (#t e)) (error "msg" 1 "two")))   ; (1 "two")
+(guard (e ((string? e) (string-append "caught " e))) (raise "oops"))   ; "caught oops"
+(guard (e ((symbol? e) e)) (+ 1 (raise 'boom)))   ; boom
+(guard (e ((number? e) (* e 2))) (guard (e ((string? e) 'inner)) (raise 21)))   ; 42
+(guard (e (#f 'no) (else 'yes)) (raise 1))   ; yes
+(guard (e (#t 'unused)) 'fine)          ; fine
+(guard (e (#t (list 'outer e))) (let ((throw raise) (raise list)) (guard (e (#f 0)) (throw 'x))))   ; (outer x)
+(error-object? (guard (e (#t e)) (vector-ref (vector 1) 5)))   ; #t
+(with-exception-handler (lambda (e) (list 'handled e)) (lambda () (raise 'x)))   ; (handled x)
+(with-exception-handler error-object-message (lambda () (read (open-input-string "(1 2"))))   ; "end of file inside a list"
+(define bad (open-input-string ") 1abc \"s\"x #12x 7 \"open"))   ; ok
+(define (read-all p) (let ((v (guard (e (#t 'err)) (read p)))) (if (eof-object? v) '() (cons v (read-all p)))))   ; ok
+(read-all bad)                          ; (err err err err x 7 err)
+(define repl (cdr (run-process "sh" "-c" "cd .. && printf 'bs-repl-error\\n)\\n(+ 1 2)\\n' | ./bs bsrepl.scm")))   ; ok
+(read-line repl)                        ; "Welcome to the bs REPL. Press ctrl-d to exit."
+(read-line repl)                        ; "bs> error: variable 'bs-repl-error' is not bound"
+(read-line repl)                        ; "bs> error: unexpected closing parenthesis"
+(read-line repl)                        ; "bs> 3"
+(error-object? 5)                       ; #f
+(car (run-process "rm" "-f" "serve.sock"))   ; 0
+(define serve-client "import socket,sys;s=socket.socket(socket.AF_UNIX);s.connect('serve.sock');s.sendall(b'(+ 1 2) ) (+ 3 4)');sys.stdout.write(s.makefile().read())")   ; ok
+(define sr (cdr (run-process "sh" "-c" (string-append "../bs --serve serve.sock >/dev/null & while [ ! -S serve.sock ];do sleep 0.1;done && python3 -c \"" serve-client "\" && kill $! && rm serve.sock"))))   ; ok
+(read sr)                               ; (ok 3)
+(read sr)                               ; (error "unexpected closing parenthesis")
+(eof-object? (read sr))                 ; #t
+(car (run-process "sh" "-c" "echo '(define (spin n) (if (> n 0) (spin (- n 1)))) (spin 200000) (display 1)' > batch1.scm && echo '(display 2) (car 3)' > batch2.scm && echo '(display 3)' > batch3.scm"))   ; 0
+(define jr (run-process "sh" "-c" "../bs -j 2 batch1.scm batch2.scm batch3.scm 2>/dev/null;s=$?;rm batch1.scm batch2.scm batch3.scm;exit $s"))   ; ok
+(car jr)                                ; 1
+(read-line (cdr jr))                    ; "123"
@@ -5,104 +5,411 @@
  */
 
 #include <stdio.h>
+#include "gc.h"
 
 #include "error.h"
 #include "object.h"
 #include "port.h"
+#include "table.h"
 #include "write.h"
 
+static void write_datum(object *exp, int shared);
+static void write_atom(object *exp);
 static void write_string(object *exp);
-static void write_pair(object *exp);
 
+
+/* Writes exp. Datum labels are only used for structure that contains a
+ * cycle, so that every datum can be written in finite space.
+ */
 void bs_write(object *exp)
+{
+    write_datum(exp, 0);
+}
+
+
+/* Writes exp, labelling every pair or vector that appears more than once in
+ * it.
+ */
+void bs_write_shared(object *exp)
+{
+    write_datum(exp, 1);
+}
+
+
+/* The writer never recurses. Both the search for shared structure and the
+ * printing itself keep their work on an explicit stack of these entries.
+ */
+enum write_task {
+    WRITE_DATUM,        // write obj
+    WRITE_REST,         // write obj as the remainder of a list
+    WRITE_CLOSE,        // write a closing parenthesis
+    WRITE_ELEMENTS,     // write the elements of vector obj from index on
+    SCAN_DONE           // everything reachable from obj has been scanned
+};
+
+struct write_entry {
+    enum write_task task;
+    object *obj;
+    long index;
+};
+
+struct write_stack {
+    struct write_entry *entries;
+    size_t count, size;
+};
+
+
+#define WRITE_STACK_SIZE 64
+
+
+static void push_index(struct write_stack *stack, enum write_task task,
+        object *obj, long index)
+{
+    if (stack->count == stack->size) {
+        stack->size = stack->size == 0 ? WRITE_STACK_SIZE : stack->size * 2;
+        stack->entries = GC_REALLOC(stack->entries,
+                stack->size * sizeof(struct write_entry));
+        if (stack->entries == NULL) {
+            error("unable to grow writer stack:");
+        }
+    }
+    stack->entries[stack->count].task = task;
+    stack->entries[stack->count].obj = obj;
+    stack->entries[stack->count].index = index;
+    stack->count++;
+}
+
+
+static inline void push(struct write_stack *stack, enum write_task task,
+        object *obj)
+{
+    push_index(stack, task, obj, 0);
+}
+
+
+static inline int is_container(object *obj)
+{
+    return is_pair(obj) || is_vector(obj);
+}
+
+
+/* States of a pair or vector in the label table. Those that have been given
+ * a label number n are stored as LABEL_BASE + n.
+ */
+#define SCAN_ACTIVE 1       // still being scanned; reaching it again is a cycle
+#define SCAN_FINISHED 2     // scanned, and not known to need a label
+#define LABEL_WANTED 3      // needs a label, which it gets when first written
+#define LABEL_BASE 4
+
+
+/* Finds the pairs and vectors in exp that need labels. One needs a label if
+ * it can be reached from itself or, when shared is true, if it can be reached
+ * more than once. Returns NULL if nothing needs a label.
+ */
+static struct object_table *find_labels(object *exp, int shared,
+        struct write_stack *stack)
+{
+    struct object_table *table = make_object_table();
+    int labelled = 0;
+
+    push(stack, WRITE_DATUM, exp);
+    while (stack->count > 0) {
+        struct write_entry entry = stack->entries[--stack->count];
+        object *obj = entry.obj;
+
+        if (entry.task == SCAN_DONE) {
+            if (object_table_get(table, obj) == SCAN_ACTIVE) {
+                object_table_put(table, obj, SCAN_FINISHED);
+            }
+            continue;
+        } else if (!is_container(obj)) {
+            continue;
+        }
+
+        long state = object_table_get(table, obj);
+        if (state == 0) {
+            object_table_put(table, obj, SCAN_ACTIVE);
+            push(stack, SCAN_DONE, obj);
+            if (is_pair(obj)) {
+                push(stack, WRITE_DATUM, cdr(obj));
+                push(stack, WRITE_DATUM, car(obj));
+            } else {
+                for (long i = obj->value.vector.length - 1; i >= 0; i--) {
+                    push(stack, WRITE_DATUM, obj->value.vector.items[i]);
+                }
+            }
+        } else if (state == SCAN_ACTIVE || (shared && state == SCAN_FINISHED)) {
+            object_table_put(table, obj, LABEL_WANTED);
+            labelled = 1;
+        }
+    }
+
+    return labelled ? table : NULL;
+}
+
+
+/* A walk of a datum looking for cycles, without a table. Each frame is a
+ * pair or vector the walk has descended into, and pos is where in it the
+ * walk is. A list is walked along its cdrs in a single frame, with slow
+ * trailing pos at half speed to catch a cycle of cdrs.
+ */
+struct cycle_frame {
+    object *pos;
+    object *slow;
+    long length;    // how far pos is along the list
+    long index;     // the next vector element, or which part of pos is next
+};
+
+#define CYCLE_CHECK_DEPTH 64
+#define CYCLE_CHECK_STEPS (1L << 24)
+
+#define NEXT_CAR 0
+#define NEXT_CDR 1
+#define NEXT_NONE 2
+
+
+/* Returns true if exp is known to contain no cycle, so that plain write can
+ * do without a label table. exp is walked as a tree: a cycle through a car
+ * or vector element makes the walk descend again from a position it is
+ * already descending from, and any other cycle is one of cdrs. The walk gives
+ * up and returns false if it nests too deep or takes too long, as it can for
+ * a datum that shares a lot of structure.
+ */
+static int is_surely_acyclic(object *exp)
+{
+    struct cycle_frame frames[CYCLE_CHECK_DEPTH];
+    int depth = 0;
+    long steps = 0;
+    object *child = exp;
+
+    for (;;) {
+        if (is_container(child)) {
+            if (depth == CYCLE_CHECK_DEPTH) {
+                return 0;
+            }
+            for (int i = 0; i < depth - 1; i++) {
+                if (frames[i].pos == frames[depth - 1].pos) {
+                    return 0;
+                }
+            }
+            frames[depth].pos = frames[depth].slow = child;
+            frames[depth].length = 0;
+            frames[depth].index = 0;
+            depth++;
+        }
+
+        // Move to the next element of the innermost pair or vector, leaving
+        // those that are finished.
+        child = NULL;
+        while (child == NULL) {
+            if (depth == 0) {
+                return 1;
+            } else if (++steps > CYCLE_CHECK_STEPS) {
+                return 0;
+            }
+
+            struct cycle_frame *f = &frames[depth - 1];
+            if (is_vector(f->pos)) {
+                if (f->index < f->pos->value.vector.length) {
+                    child = f->pos->value.vector.items[f->index++];
+                } else {
+                    depth--;
+                }
+            } else if (f->index == NEXT_CAR) {
+                child = car(f->pos);
+                f->index = NEXT_CDR;
+            } else if (f->index == NEXT_CDR && is_pair(cdr(f->pos))) {
+                f->pos = cdr(f->pos);
+                f->length++;
+                if (f->length % 2 == 0) {
+                    f->slow = cdr(f->slow);
+                }
+                if (f->pos == f->slow) {
+                    return 0;
+                }
+                f->index = NEXT_CAR;
+            } else if (f->index == NEXT_CDR) {
+                child = cdr(f->pos);
+                f->index = NEXT_NONE;
+            } else {
+                depth--;
+            }
+        }
+    }
+}
+
+
+/* Writes a label definition or reference for obj, if it has one. Returns true
+ * if a reference was written, in which case obj itself must not be.
+ */
+static int write_label(struct object_table *labels, object *obj, long *next)
+{
+    if (labels == NULL || !is_container(obj)) {
+        return 0;
+    }
+
+    long state = object_table_get(labels, obj);
+    if (state >= LABEL_BASE) {
+        write_output_char('#');
+        write_output_number(state - LABEL_BASE);
+        write_output_char('#');
+        return 1;
+    } else if (state == LABEL_WANTED) {
+        write_output_char('#');
+        write_output_number(*next);
+        write_output_char('=');
+        object_table_put(labels, obj, LABEL_BASE + *next);
+        (*next)++;
+    }
+    return 0;
+}
+
+
+static void write_datum(object *exp, int shared)
 {
     if (exp == NULL) {
         // don't write anything for null expressions.
         return;
+    } else if (!is_container(exp)) {
+        write_atom(exp);
+        return;
+    }
+
+    struct write_stack stack = { NULL, 0, 0 };
+    struct object_table *labels = shared || !is_surely_acyclic(exp) ?
+        find_labels(exp, shared, &stack) : NULL;
+    long next_label = 0;
+
+    push(&stack, WRITE_DATUM, exp);
+    while (stack.count > 0) {
+        struct write_entry entry = stack.entries[--stack.count];
+        object *obj = entry.obj;
+
+        switch (entry.task) {
+            case WRITE_DATUM:
+                if (write_label(labels, obj, &next_label)) {
+                    break;
+                } else if (is_pair(obj)) {
+                    write_output_char('(');
+                    push(&stack, WRITE_REST, cdr(obj));
+                    push(&stack, WRITE_DATUM, car(obj));
+                } else if (is_vector(obj)) {
+                    write_output_string("#(");
+                    push(&stack, WRITE_ELEMENTS, obj);
+                } else {
+                    write_atom(obj);
+                }
+                break;
+            case WRITE_REST:
+                if (is_empty_list(obj)) {
+                    write_output_char(')');
+                } else if (is_pair(obj) && (labels == NULL ||
+                            object_table_get(labels, obj) < LABEL_WANTED)) {
+                    write_output_char(' ');
+                    push(&stack, WRITE_REST, cdr(obj));
+                    push(&stack, WRITE_DATUM, car(obj));
+                } else {
+                    write_output_string(" . ");
+                    push(&stack, WRITE_CLOSE, NULL);
+                    push(&stack, WRITE_DATUM, obj);
+                }
+                break;
+            case WRITE_CLOSE:
+                write_output_char(')');
+                break;
+            case WRITE_ELEMENTS:
+                if (entry.index == obj->value.vector.length) {
+                    write_output_char(')');
+                    break;
+                } else if (entry.index > 0) {
+                    write_output_char(' ');
+                }
+                push_index(&stack, WRITE_ELEMENTS, obj, entry.index + 1);
+                push(&stack, WRITE_DATUM, obj->value.vector.items[entry.index]);
+                break;
+            case SCAN_DONE:
+                break;
+        }
     }
+}
+
 
+static void write_atom(object *exp)
+{
     if (is_number(exp)) {
-        write_output("%ld", exp->value.number);
+        write_output_number(exp->value.number);
     } else if (is_boolean(exp)) {
-        write_output("#%c", is_false(exp) ? 'f' : 't');
+        write_output_string(is_false(exp) ? "#f" : "#t");
     } else if (is_character(exp)) {
-        write_output("#\\");
+        write_output_string("#\\");
         if (exp->value.character == '\n') {
-            write_output("newline");
+            write_output_string("newline");
         } else if (exp->value.character == ' ') {
-            write_output("space");
+            write_output_string("space");
         } else {
-            write_output("%c", exp->value.character);
+            write_output_char(exp->value.character);
         }
     } else if (is_string(exp)) {
         write_string(exp);
     } else if (is_symbol(exp)) {
-        write_output("%s", exp->value.symbol);
+        write_output_string(exp->value.symbol);
     } else if (is_empty_list(exp)) {
-        write_output("()");
-    } else if (is_pair(exp)) {
-        write_output("(");
-        write_pair(exp);
-        write_output(")");
+        write_output_string("()");
     } else if (is_procedure(exp)) {
-        write_output("#<procedure>");
+        write_output_string("#<procedure>");
     } else if (is_input_port(exp)) {
-        write_output("#<input-port>");
+        write_output_string("#<input-port>");
     } else if (is_output_port(exp)) {
-        write_output("#<output-port>");
+        write_output_string("#<output-port>");
     } else if (is_end_of_file(exp)) {
-        write_output("#<eof>");
+        write_output_string("#<eof>");
+    } else if (is_autoload(exp)) {
+        write_output_string("#<autoload>");
+    } else if (is_error_object(exp)) {
+        write_output_string("#<error-object>");
     } else {
         warn("unknown expression type");
     }
 }
 
 
+/* Writes a string literal. Runs of characters that need no escaping are
+ * written in one go.
+ */
 static void write_string(object *exp)
 {
-    write_output("\"");
-    char const *pos = exp->value.string;
+    write_output_char('"');
+    char const *run = exp->value.string;
+    char const *pos = run;
     while (*pos != '\0') {
+        char const *escape = NULL;
         if (*pos == '\n') {
-            write_output("\\n");
+            escape = "\\n";
         } else if (*pos == '"') {
-            write_output("\\\"");
+            escape = "\\\"";
         } else if (*pos == '\\') {
-            write_output("\\\\");
-        } else {
-            write_output("%c", *pos);
+            escape = "\\\\";
         }
-        pos++;
-    }
-    write_output("\"");
-}
-
-
-static void write_pair(object *exp)
-{
-    bs_write(car(exp));
 
-    object *cdr_obj = cdr(exp);
-    if (is_pair(cdr_obj)) {
-        write_output(" ");
-        write_pair(cdr_obj);
-    } else if (is_empty_list(cdr_obj)) {
-        return;
-    } else {
-        write_output(" . ");
-        bs_write(cdr_obj);
+        if (escape != NULL) {
+            write_output_bytes(run, (size_t)(pos - run));
+            write_output_string(escape);
+            run = pos + 1;
+        }
+        pos++;
     }
+    write_output_bytes(run, (size_t)(pos - run));
+    write_output_char('"');
 }
 
 
 void display(object *exp)
 {
     if (is_string(exp)) {
-        write_output("%s", exp->value.string);
+        write_output_string(exp->value.string);
     } else if (is_character(exp)) {
-        write_output("%c", exp->value.character);
+        write_output_char(exp->value.character);
     } else {
         bs_write(exp);
     }
 }
-